@@ -0,0 +1,97 @@
+#pragma once
+#include "netkitten.cpp"
+#include "sequenceset.cpp"
+
+
+
+struct AckReport            //what one stack from the partner acknowledged, the receiver passes it on to the transmitter
+{
+    uint32_t cumulative;
+    uint32_t bitmap;
+    std::chrono::steady_clock::time_point arrived;      //when the receiver read the stack, RTT samples count to here and not to when the transmitter got around to it
+};
+
+
+
+class AckTracker        //what was received from the partner, reported as cumulative ACK plus a selective ACK bitmap
+{
+    private:
+    SequenceSet seen;                       //every sequence number received so far
+    bool unsent = false;                    //state changed since it was last put into a stack
+
+    public:
+    void received(uint32_t sequence)
+    {
+        unsent = true;                      //also on duplicates, the partner evidently missed our last ACK
+        seen.insert(sequence);
+    }
+
+
+
+    bool has(uint32_t sequence) const
+    {
+        return seen.contains(sequence);
+    }
+
+
+
+    uint32_t cumulative() const             //every sequence number below was received
+    {
+        return seen.runEnd(0);
+    }
+
+
+
+    uint32_t bitmap() const                 //bit i is set if cumulative()+1+i was received
+    {
+        uint32_t cumulative_ack = cumulative();
+        uint32_t bits = 0;
+        seen.forEachRunAfter(cumulative_ack, [&](uint32_t first, uint32_t end)
+        {
+            for(uint32_t sequence = first; sequence < end; sequence++)
+            {
+                uint32_t offset = sequence - cumulative_ack - 1;
+                if(offset >= SACK_BITS)
+                {
+                    return false;
+                }
+                bits |= uint32_t(1) << offset;
+            }
+            return true;
+        });
+        return bits;
+    }
+
+
+
+    bool hasUnsent() const
+    {
+        return unsent;
+    }
+
+
+
+    void markSent()
+    {
+        unsent = false;
+    }
+
+
+
+    void markUnsent()               //report the state again, e.g. after a resync may have swallowed it
+    {
+        unsent = true;
+    }
+
+
+
+    static bool covers(uint32_t sequence, uint32_t cumulative, uint32_t bitmap)     //does a received cumulative ACK plus bitmap acknowledge sequence
+    {
+        if(sequence < cumulative)
+        {
+            return true;
+        }
+        uint32_t offset = sequence - cumulative - 1;
+        return sequence != cumulative && offset < SACK_BITS && (bitmap >> offset) & 1;
+    }
+};
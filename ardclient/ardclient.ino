@@ -1,5 +1,38 @@
+// Bridge between NetKitten and the 4 outgoing (D8-D11) and 4 incoming (D4-D7) lines.
+//
+// Single nibble commands, one USB round trip each:
+//   'W' data          write the low 4 bits of data to D8-D11
+//   'R'               reply with D4-D7 as the low 4 bits
+// Batched commands, the timing is done here instead of on the host:
+//   'T' period count nibbles   queue count nibbles (two per byte, high nibble first), written one per period (us, 4 byte big endian)
+//   'S' period count           sample D4-D7 count times one period apart, every sample is sent back as soon as it was taken
+//   'V'                        reply 'V' and the protocol version, hosts use it to find out batching is there
+//   'U' index                  reply 'U', then switch to BAUDS[index]; without a 'P' at the new rate within a second we fall back to BOOT_BAUD
+//   'P'                        reply 'P'
+
+const uint8_t PROTOCOL_VERSION = 2;
+const long BOOT_BAUD = 9600;
+const long BAUDS[] = {9600, 19200, 38400, 57600, 115200, 230400, 500000, 1000000};
+const uint8_t BAUD_COUNT = sizeof(BAUDS) / sizeof(BAUDS[0]);
+
+const uint8_t QUEUE_SIZE = 128;                 // power of two
+uint8_t tx_queue[QUEUE_SIZE];
+uint8_t tx_head = 0;                            // next free slot
+uint8_t tx_tail = 0;                            // next nibble to write
+unsigned long tx_period = 60000;
+unsigned long tx_next = 0;
+
+uint8_t rx_remaining = 0;
+unsigned long rx_period = 60000;
+unsigned long rx_next = 0;
+
+bool awaiting_ping = false;                     // switched baud rate, the host still has to prove it followed
+unsigned long baud_deadline = 0;
+
+
+
 void setup() {
-  Serial.begin(9600);      // Initialize Serial communication at 9600 baud
+  Serial.begin(BOOT_BAUD);
 
   // Configure pins D4-D7 as inputs for reading
   for (int i = 4; i <= 7; i++) {
@@ -12,27 +45,124 @@ void setup() {
   }
 }
 
-void loop() 
+
+
+void writeLines(uint8_t data) {
+  PORTB = (PORTB & 0xF0) | (data & 0x0F);       // D8-D11 are PORTB 0-3, keep the upper bits
+}
+
+
+
+uint8_t readLines() {
+  return (PIND >> 4) & 0x0F;                    // D4-D7 are PIND 4-7
+}
+
+
+
+void service() {                                // plays queued nibbles and takes due samples, called whenever we would wait
+  unsigned long now = micros();
+
+  if (tx_head != tx_tail && (long)(now - tx_next) >= 0) {
+    writeLines(tx_queue[tx_tail]);
+    tx_tail = (tx_tail + 1) & (QUEUE_SIZE - 1);
+    tx_next += tx_period;
+  }
+
+  if (rx_remaining > 0 && (long)(now - rx_next) >= 0) {
+    Serial.write(readLines());
+    rx_next += rx_period;
+    rx_remaining--;
+  }
+
+  if (awaiting_ping && (long)(millis() - baud_deadline) >= 0) {
+    awaiting_ping = false;
+    Serial.begin(BOOT_BAUD);                    // the host did not follow, meet it at the start again
+  }
+}
+
+
+
+uint8_t readByte() {                            // the rest of a command, the lines keep their timing meanwhile
+  while (Serial.available() < 1) {
+    service();
+  }
+  return Serial.read();
+}
+
+
+
+unsigned long readPeriod() {
+  unsigned long value = 0;
+  for (int i = 0; i < 4; i++) {
+    value = (value << 8) | readByte();
+  }
+  return value;
+}
+
+
+
+void queueNibble(uint8_t data) {
+  while (((tx_head + 1) & (QUEUE_SIZE - 1)) == tx_tail) {
+    service();                                  // full, wait for a slot
+  }
+  if (tx_head == tx_tail && (long)(micros() - tx_next) > (long)tx_period) {
+    tx_next = micros();                         // the queue ran dry a while ago, start right away instead of catching up
+  }
+  tx_queue[tx_head] = data & 0x0F;
+  tx_head = (tx_head + 1) & (QUEUE_SIZE - 1);
+}
+
+
+
+void loop()
 {
-  if (Serial.available() > 0) {
-    char command = Serial.read();  // Read the command sent from the PC
-
-    if (command == 'R') {          // 'R' for Read
-      // Read the state of pins D4-D7 (last 4 bits of PIND)
-      uint8_t pinState = (PIND >> 4) & 0x0F;  // Extract bits 4-7 (D4-D7)
-
-      Serial.write(pinState);      // Send the 4-bit data back to the PC      
-    } 
-    else if (command == 'W') {     // 'W' for Write
-      while (Serial.available() < 1) {
-        // Wait for the next byte, which should be the 4-bit data to write
-      }
+  service();
+  if (Serial.available() < 1) {
+    return;
+  }
 
-      uint8_t data = Serial.read();  // Read the 4-bit data to write
-      data &= 0x0F;                  // Ensure only the last 4 bits are used
+  char command = Serial.read();  // Read the command sent from the PC
 
-      // Write the 4-bit data to D8-D11 (PORTB pins 0-3)
-      PORTB = data; // Preserve the upper bits of PORTB and set the lower bits
+  if (command == 'R') {          // 'R' for Read
+    Serial.write(readLines());   // Send the 4-bit data back to the PC
+  }
+  else if (command == 'W') {     // 'W' for Write
+    writeLines(readByte());
+  }
+  else if (command == 'T') {     // 'T' for Transmit a timed burst
+    tx_period = readPeriod();    // applies to everything queued, the host only changes it once the queue ran empty
+    uint8_t count = readByte();
+    for (int i = 0; i < count; i += 2) {
+      uint8_t pair = readByte();
+      queueNibble(pair >> 4);
+      if (i + 1 < count) {
+        queueNibble(pair);
+      }
+    }
+  }
+  else if (command == 'S') {     // 'S' for Sample a timed run
+    rx_period = readPeriod();
+    rx_remaining = readByte();
+    rx_next = micros();
+  }
+  else if (command == 'V') {
+    Serial.write('V');
+    Serial.write(PROTOCOL_VERSION);
+  }
+  else if (command == 'U') {
+    uint8_t index = readByte();
+    if (index >= BAUD_COUNT) {
+      Serial.write('N');
+      return;
     }
+    Serial.write('U');
+    Serial.flush();              // the reply still goes out at the old rate
+    Serial.begin(BAUDS[index]);
+    awaiting_ping = true;
+    baud_deadline = millis() + 1000;
+  }
+  else if (command == 'P') {
+    awaiting_ping = false;
+    Serial.write('P');
   }
 }
@@ -0,0 +1,297 @@
+// NetKitten's physical layer on the board: the 4 outgoing (D8-D11) and 4 incoming (D4-D7) lines are
+// driven and sampled from a timer interrupt, so no host scheduler sits between a symbol and its clock.
+// Groups go on the wire in the framed line coding (lead-in 0F 00, 8 data nibbles, lead-out 00 0F),
+// the peer has to use -coding framed.
+//
+// Host to board:
+//   'F'                        reply 'F' and PHY_VERSION, hosts use it to find this firmware
+//   'W' data                   write the low 4 bits of data to D8-D11 right away
+//   'X' period                 symbol period we send with (us, 4 byte big endian), applies to everything queued
+//   'Y' period                 symbol period the partner sends with
+//   'G' count bytes            queue count groups of 4 bytes for sending
+// Board to host:
+//   'g' bytes                  4 bytes of a group read off the wire
+//   'c' valid checksum         CRC verdict for the stack the next 'g' completes, 1 if the 4 byte checksum field matched
+
+const uint8_t PHY_VERSION = 1;
+const long BAUD = 500000;                       // 0% error at 16 MHz
+const unsigned long TICK_US = 50;               // timer interrupt period, the resolution of edges and samples
+const unsigned long MIN_TICKS = 8;              // shortest symbol period in ticks
+
+const uint8_t GROUP_BYTES = 4;
+const uint8_t GROUP_NIBBLES = 3 * GROUP_BYTES;  // framing included
+
+// Stack layout, same as netkitten.cpp
+const uint8_t SOH = 0x01;
+const uint8_t POS_FORMAT = 1;
+const uint8_t POS_CHECKSUM = 26;
+const uint8_t STACK_SIZE = 32 + 64;             // HEADER_SIZE + BYTE_PER_PACKAGE
+const uint8_t FEC_PARITY = 8;
+const uint8_t CRC16 = 1;
+const uint8_t CRC32C = 2;
+
+const uint8_t TX_SIZE = 128;                    // nibbles, power of two
+volatile uint8_t tx_queue[TX_SIZE];
+volatile uint8_t tx_head = 0;                   // next free slot, written by loop()
+volatile uint8_t tx_tail = 0;                   // next nibble to write, written by the interrupt
+volatile uint16_t tx_ticks = 60000 / TICK_US;
+uint16_t tx_countdown = 0;                      // ticks until the next nibble may go out
+
+const uint8_t RX_GROUPS = 16;                   // power of two
+volatile uint8_t rx_groups[RX_GROUPS][GROUP_BYTES];
+volatile uint8_t rx_head = 0;                   // written by the interrupt
+volatile uint8_t rx_tail = 0;                   // written by loop()
+volatile uint16_t rx_ticks = 60000 / TICK_US;
+enum RxState : uint8_t { HUNT, SAMPLE, HOLD_OFF };
+RxState rx_state = HUNT;
+uint8_t rx_last = 0xFF;                         // line state at the last tick while hunting
+uint16_t rx_countdown = 0;
+uint8_t rx_index = 0;                           // data nibbles of the current group sampled so far
+uint8_t rx_nibbles[2 * GROUP_BYTES];
+
+uint8_t stack[STACK_SIZE + FEC_PARITY];         // groups since the last SOH group, to check its CRC
+uint8_t stack_fill = 0;
+
+
+
+void writeLines(uint8_t data) {
+  PORTB = (PORTB & 0xF0) | (data & 0x0F);       // D8-D11 are PORTB 0-3, keep the upper bits
+}
+
+
+
+uint8_t readLines() {
+  return (PIND >> 4) & 0x0F;                    // D4-D7 are PIND 4-7
+}
+
+
+
+void setup() {
+  Serial.begin(BAUD);
+
+  for (int i = 4; i <= 7; i++) {
+    pinMode(i, INPUT);
+  }
+  for (int i = 8; i <= 11; i++) {
+    pinMode(i, OUTPUT);
+  }
+
+  noInterrupts();
+  TCCR1A = 0;
+  TCCR1B = (1 << WGM12) | (1 << CS11);          // CTC, prescaler 8: 2 MHz
+  OCR1A = TICK_US * 2 - 1;
+  TIMSK1 = (1 << OCIE1A);
+  interrupts();
+}
+
+
+
+ISR(TIMER1_COMPA_vect) {
+  if (tx_countdown > 0) {
+    tx_countdown--;
+  }
+  if (tx_countdown == 0 && tx_tail != tx_head) {
+    writeLines(tx_queue[tx_tail]);
+    tx_tail = (tx_tail + 1) & (TX_SIZE - 1);
+    tx_countdown = tx_ticks;
+  }
+
+  uint8_t now = readLines();
+  switch (rx_state) {
+    case HUNT:                                  // falling edge of the lead-in
+      if (rx_last == 0x0F && now == 0x00) {
+        rx_state = SAMPLE;
+        rx_countdown = rx_ticks + rx_ticks / 2; // past the 00 nibble, into the middle of the first data nibble
+        rx_index = 0;
+      }
+      rx_last = now;
+      break;
+
+    case SAMPLE:
+      if (--rx_countdown > 0) {
+        break;
+      }
+      rx_nibbles[rx_index++] = now;
+      rx_countdown = rx_ticks;
+      if (rx_index < 2 * GROUP_BYTES) {
+        break;
+      }
+      if (((rx_head + 1) & (RX_GROUPS - 1)) != rx_tail) {       // the host fell behind, the group is lost and the CRC sorts it out
+        for (uint8_t i = 0; i < GROUP_BYTES; i++) {
+          rx_groups[rx_head][i] = (rx_nibbles[2 * i] << 4) | rx_nibbles[2 * i + 1];
+        }
+        rx_head = (rx_head + 1) & (RX_GROUPS - 1);
+      }
+      rx_state = HOLD_OFF;                      // the last data nibble may be 0F, wait for the lead-out before hunting
+      break;
+
+    case HOLD_OFF:
+      if (--rx_countdown == 0) {
+        rx_state = HUNT;
+        rx_last = 0xFF;
+      }
+      break;
+  }
+}
+
+
+
+uint16_t crc16(const uint8_t* data, uint8_t length, uint16_t crc) {        // CRC-16-CCITT, no final xor
+  for (uint8_t i = 0; i < length; i++) {
+    crc ^= uint16_t(data[i]) << 8;
+    for (uint8_t bit = 0; bit < 8; bit++) {
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+
+
+uint32_t crc32c(const uint8_t* data, uint8_t length, uint32_t crc) {       // reflected, runs on the inverted value
+  for (uint8_t i = 0; i < length; i++) {
+    crc ^= data[i];
+    for (uint8_t bit = 0; bit < 8; bit++) {
+      crc = (crc & 1) ? (crc >> 1) ^ 0x82F63B78UL : crc >> 1;
+    }
+  }
+  return crc;
+}
+
+
+
+uint8_t stackSize() {                           // parity follows if at least two of the FEC format bits survived
+  uint8_t protection = stack[POS_FORMAT] >> 4;
+  uint8_t votes = (protection & 1) + ((protection >> 1) & 1) + ((protection >> 2) & 1) + (protection >> 3);
+  return votes >= 2 ? STACK_SIZE + FEC_PARITY : STACK_SIZE;
+}
+
+
+
+void sendVerdict() {                            // FEC stacks are left to the host, it may still repair them
+  uint8_t type = stack[POS_FORMAT] & 0x07;
+  if (stackSize() != STACK_SIZE || (type != CRC16 && type != CRC32C)) {
+    return;
+  }
+  const uint8_t* rest = stack + POS_CHECKSUM + 4;
+  uint8_t rest_length = STACK_SIZE - POS_CHECKSUM - 4;
+  uint32_t computed;
+  if (type == CRC16) {
+    computed = crc16(rest, rest_length, crc16(stack, POS_CHECKSUM, 0xFFFF));
+  }
+  else {
+    computed = ~crc32c(rest, rest_length, crc32c(stack, POS_CHECKSUM, ~0UL));
+  }
+  uint32_t received = (uint32_t(stack[POS_CHECKSUM]) << 24) | (uint32_t(stack[POS_CHECKSUM + 1]) << 16) | (uint16_t(stack[POS_CHECKSUM + 2]) << 8) | stack[POS_CHECKSUM + 3];
+
+  Serial.write('c');
+  Serial.write(computed == received ? 1 : 0);
+  Serial.write(stack + POS_CHECKSUM, 4);
+}
+
+
+
+void forwardGroups() {                          // hands every group read so far to the host, a stack's verdict right before its last group
+  while (rx_tail != rx_head) {
+    uint8_t group[GROUP_BYTES];
+    for (uint8_t i = 0; i < GROUP_BYTES; i++) {
+      group[i] = rx_groups[rx_tail][i];
+    }
+    rx_tail = (rx_tail + 1) & (RX_GROUPS - 1);
+
+    if (stack_fill > 0 || group[0] == SOH) {    // same rule the host uses to find where a stack starts
+      memcpy(stack + stack_fill, group, GROUP_BYTES);
+      stack_fill += GROUP_BYTES;
+      if (stack_fill == stackSize()) {
+        sendVerdict();
+        stack_fill = 0;
+      }
+    }
+    Serial.write('g');
+    Serial.write(group, GROUP_BYTES);
+  }
+}
+
+
+
+uint8_t readByte() {                            // the rest of a command, received groups keep flowing meanwhile
+  while (Serial.available() < 1) {
+    forwardGroups();
+  }
+  return Serial.read();
+}
+
+
+
+uint16_t readPeriod() {                         // in ticks
+  unsigned long value = 0;
+  for (int i = 0; i < 4; i++) {
+    value = (value << 8) | readByte();
+  }
+  return max(MIN_TICKS, min(value / TICK_US, 0xFFFFUL));
+}
+
+
+
+void queueNibble(uint8_t data) {
+  while (((tx_head + 1) & (TX_SIZE - 1)) == tx_tail) {
+    forwardGroups();                            // full, the interrupt frees a slot every period
+  }
+  tx_queue[tx_head] = data & 0x0F;
+  tx_head = (tx_head + 1) & (TX_SIZE - 1);
+}
+
+
+
+void queueGroup(const uint8_t* bytes) {         // framed line coding, see FramedCoder
+  queueNibble(0x0F);
+  queueNibble(0x00);
+  for (uint8_t i = 0; i < GROUP_BYTES; i++) {
+    queueNibble(bytes[i] >> 4);
+    queueNibble(bytes[i]);
+  }
+  queueNibble(0x00);
+  queueNibble(0x0F);
+}
+
+
+
+void loop()
+{
+  forwardGroups();
+  if (Serial.available() < 1) {
+    return;
+  }
+
+  char command = Serial.read();
+
+  if (command == 'F') {
+    Serial.write('F');
+    Serial.write(PHY_VERSION);
+  }
+  else if (command == 'W') {
+    writeLines(readByte());
+  }
+  else if (command == 'X') {
+    uint16_t ticks = readPeriod();
+    noInterrupts();
+    tx_ticks = ticks;
+    interrupts();
+  }
+  else if (command == 'Y') {
+    uint16_t ticks = readPeriod();
+    noInterrupts();
+    rx_ticks = ticks;
+    interrupts();
+  }
+  else if (command == 'G') {
+    uint8_t count = readByte();
+    for (uint8_t i = 0; i < count; i++) {
+      uint8_t bytes[GROUP_BYTES];
+      for (uint8_t k = 0; k < GROUP_BYTES; k++) {
+        bytes[k] = readByte();
+      }
+      queueGroup(bytes);
+    }
+  }
+}
@@ -0,0 +1,623 @@
+#pragma once
+#include "netkitten.cpp"
+#include "linecoder.cpp"
+#include <iomanip>
+#include <iterator>
+
+
+
+template <typename Function>
+double nanosecondsPerCall(Function && function, uint32_t calls)       //average wall time of one call
+{
+    auto begin = std::chrono::steady_clock::now();
+    for(uint32_t i = 0; i < calls; i++)
+    {
+        function(i);
+    }
+    auto elapsed = std::chrono::steady_clock::now() - begin;
+    return std::chrono::duration<double, std::nano>(elapsed).count() / calls;
+}
+
+
+
+uint16_t additiveChecksum(const uint8_t* data, size_t length)          //the plain byte sum stacks used to carry
+{
+    uint16_t checksum = 0;
+    for(size_t i = 0; i < length; i++)
+    {
+        checksum += data[i];
+    }
+    return checksum;
+}
+
+
+
+void benchChecksums()       //cost per stack and how many single two bit errors slip through
+{
+    const uint32_t calls = 200000;
+    const size_t length = HEADER_SIZE + BYTE_PER_PACKAGE;
+    std::vector<uint8_t> stack(length);
+    std::mt19937 random(1);
+    for(uint8_t & byte : stack)
+    {
+        byte = static_cast<uint8_t>(random());
+    }
+
+    volatile uint32_t sink = 0;
+    struct Candidate
+    {
+        const char* name;
+        std::function<uint32_t(const uint8_t*, size_t)> function;
+    };
+    std::vector<Candidate> candidates = {
+        {"sum16",             [](const uint8_t* d, size_t n) { return uint32_t(additiveChecksum(d, n)); }},
+        {"crc16 bytewise",    [](const uint8_t* d, size_t n) { return uint32_t(crc16Bytewise(d, n)); }},
+        {"crc16 slice-by-4",  [](const uint8_t* d, size_t n) { return uint32_t(crc16(d, n)); }},
+        {"crc32c bytewise",   [](const uint8_t* d, size_t n) { return crc32cBytewise(d, n); }},
+        {"crc32c slice-by-8", [](const uint8_t* d, size_t n) { return crc32cSliced(d, n); }},
+    };
+    if(crc32cHardwareAvailable())
+    {
+        candidates.push_back({"crc32c sse4.2", [](const uint8_t* d, size_t n) { return crc32cHardware(d, n); }});
+    }
+
+    std::cout << "checksum over a " << length << " byte stack, " << calls << " calls each" << std::endl;
+    std::cout << std::left << std::setw(20) << "algorithm" << std::setw(14) << "ns/stack" << "undetected 2-nibble errors" << std::endl;
+    for(const Candidate & candidate : candidates)
+    {
+        stack[0] ^= 1;      //keep the compiler from hoisting the call out of the loop
+        double nanoseconds = nanosecondsPerCall([&](uint32_t i) { stack[i % length] ^= 1; sink = sink + candidate.function(stack.data(), length); }, calls);
+
+        uint32_t missed = 0;
+        const uint32_t trials = 20000;
+        std::mt19937 errors(2);
+        for(uint32_t trial = 0; trial < trials; trial++)        //two corrupted nibbles, like two bad samples on the link
+        {
+            std::vector<uint8_t> corrupted = stack;
+            size_t first = errors() % length;
+            size_t second = errors() % length;
+            corrupted[first] ^= static_cast<uint8_t>((1 + errors() % 15) << (errors() % 2 * 4));
+            corrupted[second] ^= static_cast<uint8_t>((1 + errors() % 15) << (errors() % 2 * 4));
+            if(corrupted != stack && candidate.function(corrupted.data(), length) == candidate.function(stack.data(), length))
+            {
+                missed++;
+            }
+        }
+        std::cout << std::left << std::setw(20) << candidate.name << std::setw(14) << std::fixed << std::setprecision(1) << nanoseconds << missed << " of " << trials << std::endl;
+    }
+}
+
+
+
+void benchFec()         //goodput of plain and FEC stacks when data nibbles flip at a given rate
+{
+    const uint32_t stacks = 4000;
+    const uint32_t nibbles_per_byte = 2 + 4 / BYTE_BETWEEN_SYNC;
+    const double error_rates[] = {0, 0.0005, 0.001, 0.002, 0.005, 0.01, 0.02, 0.05};
+    ReedSolomon fec(FEC_PARITY);
+    std::mt19937 random(3);
+
+    std::cout << "goodput at " << SEND_DELAY << " ms per nibble, " << stacks << " stacks per rate, only data nibbles disturbed" << std::endl;
+    std::cout << std::left << std::setw(12) << "nibble err" << std::setw(14) << "plain ok %" << std::setw(16) << "plain byte/s"
+              << std::setw(12) << "fec ok %" << std::setw(14) << "fec byte/s" << "undetected" << std::endl;
+    for(double error_rate : error_rates)
+    {
+        uint32_t delivered[2] = {0, 0};
+        uint32_t undetected = 0;
+        for(uint32_t i = 0; i < stacks; i++)
+        {
+            std::vector<uint8_t> stack(HEADER_SIZE + BYTE_PER_PACKAGE + FEC_PARITY);
+            for(uint32_t b = 0; b < HEADER_SIZE + BYTE_PER_PACKAGE; b++)
+            {
+                stack[b] = static_cast<uint8_t>(random());
+            }
+            uint32_t checksum = stackChecksum(ChecksumType::Crc32c, stack.data());
+            for(int b = 0; b < 4; b++)
+            {
+                stack[POS_CHECKSUM + b] = static_cast<uint8_t>(checksum >> (24 - 8 * b));
+            }
+            fec.encode(stack.data(), HEADER_SIZE + BYTE_PER_PACKAGE, stack.data() + HEADER_SIZE + BYTE_PER_PACKAGE);
+
+            for(int protect = 0; protect < 2; protect++)
+            {
+                size_t length = HEADER_SIZE + BYTE_PER_PACKAGE + (protect ? FEC_PARITY : 0);
+                std::vector<uint8_t> received(stack.begin(), stack.begin() + length);
+                for(size_t nibble = 0; nibble < length * 2; nibble++)
+                {
+                    if(std::uniform_real_distribution<double>(0, 1)(random) < error_rate)
+                    {
+                        received[nibble / 2] ^= static_cast<uint8_t>(1 << (random() % 4 + (nibble % 2 ? 0 : 4)));
+                    }
+                }
+                if(protect)
+                {
+                    fec.decode(received.data(), length);
+                }
+                uint32_t received_checksum = (received[POS_CHECKSUM] << 24) | (received[POS_CHECKSUM+1] << 16) | (received[POS_CHECKSUM+2] << 8) | received[POS_CHECKSUM+3];
+                if(stackChecksum(ChecksumType::Crc32c, received.data()) != received_checksum)
+                {
+                    continue;
+                }
+                if(!std::equal(received.begin(), received.begin() + HEADER_SIZE + BYTE_PER_PACKAGE, stack.begin()))
+                {
+                    undetected++;
+                    continue;
+                }
+                delivered[protect]++;
+            }
+        }
+
+        double goodput[2];
+        for(int protect = 0; protect < 2; protect++)        //every failed stack is sent again, selective repeat
+        {
+            double airtime = (HEADER_SIZE + BYTE_PER_PACKAGE + (protect ? FEC_PARITY : 0)) * nibbles_per_byte * SEND_DELAY / 1000.0;
+            goodput[protect] = double(delivered[protect]) / stacks * BYTE_PER_PACKAGE / airtime;
+        }
+        std::cout << std::left << std::setw(12) << error_rate
+                  << std::setw(14) << std::fixed << std::setprecision(1) << 100.0 * delivered[0] / stacks << std::setw(16) << std::setprecision(2) << goodput[0]
+                  << std::setw(12) << std::setprecision(1) << 100.0 * delivered[1] / stacks << std::setw(14) << std::setprecision(2) << goodput[1]
+                  << undetected << std::defaultfloat << std::endl;
+    }
+}
+
+
+
+class ReplayedWire         //a coded nibble stream played back on a virtual clock, six polls per symbol, the reader's clock off by skew
+{
+    private:
+    static const uint64_t TICKS = 720720;       //per symbol, divisible by six and by every oversampling rate
+    std::vector<uint8_t> symbols;
+    uint64_t tick = 0;
+    double skew;
+
+    uint8_t current() const
+    {
+        return symbols[std::min<size_t>(tick / TICKS, symbols.size() - 1)];
+    }
+
+    uint8_t advance(uint64_t length)            //reads the lines, then waits length ticks of the reader's clock
+    {
+        uint8_t value = current();
+        tick += std::llround(length * (1 + skew));
+        return value;
+    }
+
+    public:
+    explicit ReplayedWire(const std::vector<uint8_t> & nibbles, double reader_skew = 0)
+        : skew(reader_skew)
+    {
+        symbols.reserve(2 + nibbles.size());
+        symbols.push_back(0);                   //the lines idle low before the first group
+        symbols.push_back(0);
+        for(uint8_t nibble : nibbles)
+        {
+            symbols.push_back(nibble);
+        }
+    }
+
+    NibbleReader reader()
+    {
+        return {
+            [this] { return advance(TICKS); },
+            [this] { return advance(TICKS / 6); },
+            [this](uint8_t* out, size_t count) { for(size_t i = 0; i < count; i++) { out[i] = advance(TICKS); } },
+            [this](uint8_t* out, size_t count, uint32_t per_symbol) { for(size_t i = 0; i < count; i++) { out[i] = advance(TICKS / per_symbol); } },
+        };
+    }
+};
+
+
+
+void benchLineCoding()      //nibbles on the wire per byte for every line coding, decoded again to prove the count is honest
+{
+    std::vector<uint8_t> stack(HEADER_SIZE + BYTE_PER_PACKAGE + FEC_PARITY);
+    std::mt19937 random(4);
+    for(uint8_t & byte : stack)
+    {
+        byte = static_cast<uint8_t>(random());
+    }
+
+    std::cout << "nibbles per stack of " << BYTE_PER_PACKAGE << " payload byte, airtime at " << SEND_DELAY << " ms per nibble" << std::endl;
+    std::cout << std::left << std::setw(12) << "coding" << std::setw(14) << "nibble/byte" << std::setw(14) << "plain stack" << std::setw(12) << "fec stack"
+              << std::setw(16) << "nibble/payload" << std::setw(12) << "stack s" << "roundtrip" << std::endl;
+    for(LineCoding coding : {LineCoding::Framed, LineCoding::Transition})
+    {
+        size_t lengths[2] = {HEADER_SIZE + BYTE_PER_PACKAGE, HEADER_SIZE + BYTE_PER_PACKAGE + FEC_PARITY};
+        size_t counts[2];
+        bool roundtrip = true;
+        for(int protect = 0; protect < 2; protect++)
+        {
+            std::unique_ptr<LineCoder> encoder = makeLineCoder(coding);
+            std::vector<uint8_t> nibbles;
+            for(size_t i = 0; i < lengths[protect]; i += BYTE_BETWEEN_SYNC)
+            {
+                encoder->encodeGroup(stack.data() + i, nibbles);
+            }
+            counts[protect] = nibbles.size();
+
+            std::unique_ptr<LineCoder> decoder = makeLineCoder(coding);
+            ReplayedWire wire(nibbles);
+            NibbleReader reader = wire.reader();
+            std::vector<uint8_t> decoded(lengths[protect]);
+            for(size_t i = 0; i < lengths[protect]; i += BYTE_BETWEEN_SYNC)
+            {
+                roundtrip = decoder->decodeGroup(reader, decoded.data() + i) && roundtrip;
+            }
+            roundtrip = roundtrip && std::equal(decoded.begin(), decoded.end(), stack.begin());
+        }
+
+        std::cout << std::left << std::setw(12) << makeLineCoder(coding)->name()
+                  << std::setw(14) << std::fixed << std::setprecision(2) << double(counts[0]) / lengths[0]
+                  << std::setw(14) << counts[0] << std::setw(12) << counts[1]
+                  << std::setw(16) << double(counts[0]) / BYTE_PER_PACKAGE
+                  << std::setw(12) << std::setprecision(1) << counts[0] * SEND_DELAY / 1000.0
+                  << (roundtrip ? "ok" : "FAILED") << std::defaultfloat << std::endl;
+    }
+}
+
+
+
+void benchDrift()          //framed groups read right when the receiver's clock runs off the sender's, one sample per symbol against oversampling with clock recovery
+{
+    const uint32_t groups = 2000;
+    std::vector<uint8_t> data(groups * BYTE_BETWEEN_SYNC);
+    std::mt19937 random(5);
+    for(uint8_t & byte : data)
+    {
+        byte = static_cast<uint8_t>(random());
+    }
+    FramedCoder encoder;
+    std::vector<uint8_t> nibbles;
+    for(uint32_t i = 0; i < groups; i++)
+    {
+        encoder.encodeGroup(data.data() + i * BYTE_BETWEEN_SYNC, nibbles);
+    }
+
+    std::cout << groups << " framed groups, share read right at a receiver clock skew of" << std::endl;
+    std::cout << std::left << std::setw(14) << "samples/sym";
+    const double skews[] = {-0.12, -0.08, -0.05, -0.03, 0, 0.03, 0.05, 0.08, 0.12};
+    for(double skew : skews)
+    {
+        std::cout << std::setw(8) << (std::to_string(int(std::lround(skew * 100))) + "%");
+    }
+    std::cout << std::endl;
+
+    for(uint32_t per_symbol : {1u, 4u, 8u})
+    {
+        std::cout << std::setw(14) << per_symbol;
+        for(double skew : skews)
+        {
+            FramedCoder decoder(per_symbol);
+            ReplayedWire wire(nibbles, skew);
+            NibbleReader reader = wire.reader();
+            uint32_t right = 0;
+            for(uint32_t i = 0; i < groups; i++)
+            {
+                uint8_t bytes[BYTE_BETWEEN_SYNC];
+                decoder.decodeGroup(reader, bytes);
+                right += std::equal(bytes, bytes + BYTE_BETWEEN_SYNC, data.begin() + i * BYTE_BETWEEN_SYNC);
+            }
+            std::cout << std::setw(8) << (std::to_string(right * 100 / groups) + "%");
+        }
+        std::cout << std::endl;
+    }
+}
+
+
+
+void benchCompression()     //ratio and CPU time of every compression mode over the sample files, fed in the chunks the reader thread uses
+{
+    const char* files[] = {"test.txt", "output.txt", "kapital.zip", "main.cpp"};
+    std::cout << std::left << std::setw(14) << "file" << std::setw(10) << "bytes" << std::setw(8) << "mode" << std::setw(10) << "sent"
+              << std::setw(9) << "ratio" << std::setw(12) << "pack MB/s" << std::setw(14) << "unpack MB/s" << "roundtrip" << std::endl;
+    for(const char* name : files)
+    {
+        std::ifstream file(name, std::ios::binary);
+        std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        if(data.empty())
+        {
+            continue;
+        }
+        bool skipped = looksCompressed(data.data(), data.size());
+
+        for(Compression mode : {Compression::Fast, Compression::Strong})
+        {
+            std::vector<uint8_t> blocks;
+            auto begin = std::chrono::steady_clock::now();
+            StreamCompressor compressor(mode);
+            for(size_t done = 0; done < data.size(); done += COMPRESS_BLOCK)
+            {
+                compressor.compress(data.data() + done, std::min(COMPRESS_BLOCK, data.size() - done), blocks);
+            }
+            double pack_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+            std::vector<uint8_t> restored;
+            begin = std::chrono::steady_clock::now();
+            StreamDecompressor decompressor;
+            for(size_t done = 0; done < blocks.size(); done += BYTE_PER_PACKAGE)        //arrives one package at a time
+            {
+                decompressor.feed(blocks.data() + done, std::min<size_t>(BYTE_PER_PACKAGE, blocks.size() - done), restored);
+            }
+            double unpack_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+            size_t sent = skipped ? data.size() : blocks.size();
+            std::cout << std::left << std::setw(14) << name << std::setw(10) << data.size() << std::setw(8) << (mode == Compression::Fast ? "fast" : "strong")
+                      << std::setw(10) << sent << std::setw(9) << std::fixed << std::setprecision(3) << double(sent) / data.size()
+                      << std::setw(12) << std::setprecision(1) << data.size() / pack_seconds / 1e6 << std::setw(14) << data.size() / unpack_seconds / 1e6
+                      << (restored == data ? "ok" : "FAILED") << (skipped ? ", sent raw: already compressed" : "") << std::defaultfloat << std::endl;
+        }
+    }
+}
+
+
+
+class TimedQueue          //the mutex queue the link passed ACK traffic through before Channel, kept as the baseline
+{
+private:
+    std::queue<uint32_t> queue;
+    std::unordered_set<uint32_t> set; // Auxiliary set to track unique values
+    std::timed_mutex mutex;
+
+public:
+    bool push(uint32_t value) 
+    {
+        if (mutex.try_lock_for(std::chrono::milliseconds(100))) 
+        {
+            // Check if the value is already in the set (and therefore the queue)
+            if (set.find(value) != set.end()) 
+            {
+                mutex.unlock();
+                return false; // Value already exists, do not push
+            }
+
+            // Push the value to the queue and add it to the set
+            queue.push(value);
+            set.insert(value);
+            mutex.unlock();
+            return true; // Successfully pushed
+        } 
+        else 
+        {
+            return false; // Timed out
+        }
+    }
+
+    std::optional<uint32_t> pop() 
+    {
+        if (mutex.try_lock_for(std::chrono::milliseconds(100))) 
+        {
+            if (!queue.empty()) 
+            {
+                uint32_t value = queue.front();
+                queue.pop();
+                set.erase(value); // Remove from set since it's no longer in the queue
+                mutex.unlock();
+                return value; // Successfully popped
+            } 
+            else 
+            {
+                mutex.unlock();
+                return std::nullopt; // Queue was empty
+            }
+        } 
+        else 
+        {
+            return std::nullopt; // Timed out
+        }
+    }
+
+    bool remove(uint32_t value) 
+    {
+        if (mutex.try_lock_for(std::chrono::milliseconds(100))) 
+        {
+            std::deque<uint32_t> tempDeque;
+            bool found = false;
+
+            // Iterate over the queue and move elements to tempDeque, skipping the one to remove
+            while (!queue.empty()) 
+            {
+                if (queue.front() == value && !found) 
+                {
+                    found = true; // Skip adding the value to tempDeque
+                } 
+                else 
+                {
+                    tempDeque.push_back(queue.front()); // Add all other values to tempDeque
+                }
+                queue.pop();
+            }
+
+            // Refill the original queue with the modified tempDeque
+            for (auto val : tempDeque) 
+            {
+                queue.push(val);
+                set.insert(val); // Insert back into the set
+            }
+
+            // If the value was found, remove it from the set
+            if (found) 
+            {
+                set.erase(value);
+            }
+
+            mutex.unlock();
+            return found;
+        } 
+        else 
+        {
+            return false; // Timed out
+        }
+    }
+
+    template <typename Predicate>
+    size_t removeIf(Predicate predicate)       //removes every value the predicate holds for in one pass
+    {
+        if (mutex.try_lock_for(std::chrono::milliseconds(100))) 
+        {
+            size_t removed = 0;
+            size_t count = queue.size();
+            for (size_t i = 0; i < count; i++) 
+            {
+                uint32_t value = queue.front();
+                queue.pop();
+                if (predicate(value)) 
+                {
+                    set.erase(value);
+                    removed++;
+                } 
+                else 
+                {
+                    queue.push(value);
+                }
+            }
+            mutex.unlock();
+            return removed;
+        } 
+        else 
+        {
+            return 0; // Timed out
+        }
+    }
+
+    bool contains(uint32_t value)       //assumes the value is present if the lock could not be taken
+    {
+        if (mutex.try_lock_for(std::chrono::milliseconds(100))) 
+        {
+            bool found = set.find(value) != set.end();
+            mutex.unlock();
+            return found;
+        }
+        else 
+        {
+            return true; // Timed out
+        }
+    }
+
+    bool empty() 
+    {
+        return queue.empty();
+    }
+
+    int size() 
+    {
+        return queue.size();
+    }
+
+    uint32_t front() 
+    {
+        return queue.front();
+    }
+};
+
+
+
+template <typename Queue, typename Push, typename Pop, typename Peek>
+void benchQueue(const char* name, Queue & queue, Push push, Pop pop, Peek peek, bool peeking, uint32_t values)     //one producer, one consumer, optionally a third thread that keeps asking for the size
+{
+    std::atomic<bool> producing{true};
+    std::atomic<uint32_t> refused{0};
+    uint32_t received = 0;
+    auto begin = std::chrono::steady_clock::now();
+
+    std::thread producer([&]
+    {
+        for(uint32_t i = 0; i < values; i++)
+        {
+            if(!push(queue, i))
+            {
+                refused.fetch_add(1);
+            }
+        }
+        producing.store(false);
+    });
+    std::thread peeker([&]
+    {
+        while(peeking && producing.load())
+        {
+            for(int i = 0; i < 64; i++)
+            {
+                peek(queue);
+            }
+            std::this_thread::yield();          //leave the others a core on small machines
+        }
+    });
+    bool last_round = false;
+    while(!last_round)
+    {
+        last_round = !producing.load();         //one more drain after the producer is done
+        while(pop(queue))
+        {
+            received++;
+        }
+        std::this_thread::yield();              //the transmitter does other work between polls too
+    }
+    producer.join();
+    peeker.join();
+
+    double nanoseconds = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count() / values;
+    std::cout << std::left << std::setw(14) << name << std::setw(10) << (peeking ? "yes" : "no") << std::setw(12) << std::fixed << std::setprecision(1) << nanoseconds
+              << std::setw(12) << received << refused.load() + (values - refused.load() - received) << std::defaultfloat << std::endl;
+}
+
+
+
+void benchChannels()        //ACK traffic between the receiver and transmitter threads: TimedQueue against Channel
+{
+    const uint32_t values = 200000;
+    std::cout << values << " distinct sequence numbers from one thread to another" << std::endl;
+    std::cout << std::left << std::setw(14) << "queue" << std::setw(10) << "peeker" << std::setw(12) << "ns/value" << std::setw(12) << "received" << "lost" << std::endl;
+    for(bool peeking : {false, true})
+    {
+        TimedQueue timed;
+        benchQueue("TimedQueue", timed,
+                   [](TimedQueue & q, uint32_t v) { return q.push(v); },
+                   [](TimedQueue & q) { return q.pop().has_value(); },
+                   [](TimedQueue & q) { return q.contains(0); },           //what collectAcks did once per package in flight
+                   peeking, values);
+
+        auto channel = std::make_unique<UniqueChannel<uint32_t>>();
+        benchQueue("UniqueChannel", *channel,
+                   [](UniqueChannel<uint32_t> & q, uint32_t v) { return q.pushUnique(v); },
+                   [](UniqueChannel<uint32_t> & q) { return q.pop().has_value(); },
+                   [](UniqueChannel<uint32_t> & q) { return q.size() > 0; },
+                   peeking, values);
+    }
+}
+
+
+
+int runBenchmark(const std::string & which)
+{
+    if(which == "crc")
+    {
+        benchChecksums();
+        return 0;
+    }
+    if(which == "fec")
+    {
+        benchFec();
+        return 0;
+    }
+    if(which == "line")
+    {
+        benchLineCoding();
+        return 0;
+    }
+    if(which == "drift")
+    {
+        benchDrift();
+        return 0;
+    }
+    if(which == "compress")
+    {
+        benchCompression();
+        return 0;
+    }
+    if(which == "channel")
+    {
+        benchChannels();
+        return 0;
+    }
+    std::cerr << "unknown benchmark " << which << std::endl;
+    return -1;
+}
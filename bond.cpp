@@ -0,0 +1,209 @@
+#pragma once
+#include "netkitten.cpp"
+#include "frame.cpp"
+#include "sendbuffer.cpp"
+#include "sequenceset.cpp"
+#include <sstream>
+
+
+
+constexpr HeaderField BOND_SEQUENCE{0, 4};                              //4 byte chunk number in front of the payload of a bonded stack, relative to the payload
+const uint32_t BOND_CHUNK = BYTE_PER_PACKAGE - BOND_SEQUENCE.width;     //input bytes one bonded stack carries
+
+
+
+class BondSender            //the input of a transfer striped over several links: a link cuts its next chunk from here whenever its own windows have room, so a slow or lossy link simply takes fewer
+{
+    private:
+    static constexpr uint32_t MAX_SPAN = 4096;      //chunks between the oldest unacknowledged one and the next, bounds what the partner holds for reordering
+
+    struct Offered              //a chunk a degraded link gave up on, another link carries it as well
+    {
+        uint32_t from;
+        uint8_t length;
+        std::array<uint8_t, BYTE_PER_PACKAGE> payload;
+    };
+
+    SendBuffer input;
+    std::mutex lock;
+    uint32_t next_chunk = 0;                    //number the next chunk cut from the input gets
+    SequenceSet acknowledged;                   //chunks the partner has, over whichever link
+    std::map<uint32_t, Offered> offered;        //by chunk number, the oldest goes out first
+
+    public:
+    explicit BondSender(size_t buffer_size)
+        : input(buffer_size)
+    {
+
+    }
+
+
+
+    void readInput(std::istream & in)           //reader thread shared by all links, hands the input over as soon as it arrives
+    {
+        std::vector<uint8_t> chunk;
+        char byte;
+        while(in.get(byte))
+        {
+            chunk.push_back(static_cast<uint8_t>(byte));
+            if(chunk.size() >= BOND_CHUNK || in.rdbuf()->in_avail() <= 0)
+            {
+                input.push(chunk.data(), chunk.size());
+                chunk.clear();
+            }
+        }
+        input.push(chunk.data(), chunk.size());
+        input.close();
+    }
+
+
+
+    size_t take(uint32_t link, uint8_t* payload, bool whole_only)      //the next chunk for link with its number in front, one another link gave up on first; the payload length, 0 if there is none
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        for(auto it = offered.begin(); it != offered.end();)
+        {
+            if(acknowledged.contains(it->first))
+            {
+                it = offered.erase(it);         //the link that gave up on it got through after all
+                continue;
+            }
+            if(it->second.from == link)
+            {
+                ++it;
+                continue;
+            }
+            size_t length = it->second.length;
+            std::copy(it->second.payload.begin(), it->second.payload.begin() + length, payload);
+            offered.erase(it);
+            return length;
+        }
+
+        size_t available = input.available();
+        if(available == 0 || (available < BOND_CHUNK && whole_only && !input.isClosed()) || next_chunk >= acknowledged.runEnd(0) + MAX_SPAN)
+        {
+            return 0;
+        }
+        size_t length = input.take(payload + BOND_SEQUENCE.width, BOND_CHUNK);
+        putField(payload, BOND_SEQUENCE, next_chunk++);
+        return BOND_SEQUENCE.width + length;
+    }
+
+
+
+    void offer(uint32_t link, const uint8_t* payload, size_t length)       //link lost its partner or timed out on this chunk, it keeps resending it itself
+    {
+        uint32_t chunk = getField(payload, BOND_SEQUENCE);
+        std::lock_guard<std::mutex> guard(lock);
+        if(acknowledged.contains(chunk) || offered.count(chunk) != 0)
+        {
+            return;
+        }
+        Offered & entry = offered[chunk];
+        entry.from = link;
+        entry.length = static_cast<uint8_t>(length);
+        std::copy(payload, payload + length, entry.payload.begin());
+    }
+
+
+
+    void acknowledge(const uint8_t* payload)        //the partner has this chunk
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        acknowledged.insert(getField(payload, BOND_SEQUENCE));
+    }
+
+
+
+    size_t available()          //bytes no link has taken yet
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        return input.available() + offered.size() * BOND_CHUNK;
+    }
+
+
+
+    bool finished()             //input ended and the partner has every chunk
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        return input.finished() && acknowledged.runEnd(0) == next_chunk;
+    }
+};
+
+
+
+class BondReceiver          //puts the chunks of all links back in order, one that came over two links is written once
+{
+    private:
+    struct Held
+    {
+        uint8_t length;
+        std::array<uint8_t, BOND_CHUNK> bytes;
+    };
+
+    std::ostream & output;
+    std::mutex lock;
+    SequenceSet taken;                  //chunks already written or held
+    std::map<uint32_t, Held> held;      //received ahead of next_delivery
+    uint32_t next_delivery = 0;         //chunk number the output waits for
+
+    public:
+    explicit BondReceiver(std::ostream & out)
+        : output(out)
+    {
+
+    }
+
+
+
+    void accept(const uint8_t* payload, size_t length)      //any link's receiver, with the payload of a valid stack
+    {
+        if(length < BOND_SEQUENCE.width)
+        {
+            return;
+        }
+        uint32_t chunk = getField(payload, BOND_SEQUENCE);
+        const uint8_t* bytes = payload + BOND_SEQUENCE.width;
+        length -= BOND_SEQUENCE.width;
+
+        std::lock_guard<std::mutex> guard(lock);
+        if(!taken.insert(chunk))
+        {
+            return;
+        }
+        if(chunk != next_delivery)
+        {
+            Held & entry = held[chunk];
+            entry.length = static_cast<uint8_t>(length);
+            std::copy(bytes, bytes + length, entry.bytes.begin());
+            return;
+        }
+
+        output.write(reinterpret_cast<const char*>(bytes), length);
+        next_delivery++;
+        for(auto it = held.begin(); it != held.end() && it->first == next_delivery; it = held.erase(it))
+        {
+            output.write(reinterpret_cast<const char*>(it->second.bytes.data()), it->second.length);
+            next_delivery++;
+        }
+        output.flush();
+    }
+};
+
+
+
+class Bond                  //what the links of one side share when a transfer is striped over them
+{
+    public:
+    BondSender sender;
+    BondReceiver receiver;
+    std::atomic<bool> partner_finished{false};      //the partner's EOT on any link, it sends one only once all of its input arrived here
+    std::istringstream no_input;                    //what each link's own Transmitter and Receiver get instead of the streams
+    std::ostream no_output{nullptr};
+
+    Bond(std::ostream & out, const LinkOptions & options)
+        : sender(options.send_buffer_size), receiver(out)
+    {
+
+    }
+};
@@ -0,0 +1,376 @@
+#pragma once
+#include "netkitten.cpp"
+#include "linkdriver.cpp"
+#include "linkengine.cpp"
+#include "linecoder.cpp"
+#include <iomanip>
+#include <sstream>
+
+
+
+const char* const PROFILE_PATH = "netkitten.profile";     //written by -calibrate, read by every other mode at startup
+const uint32_t CALIBRATION_PHASES = 6;          //sampling phases per symbol, the resolution of the receiver's edge polls
+const uint32_t PRBS_LENGTH = 127;               //one period of PRBS-7 per sweep step
+const uint32_t CALIBRATION_GAP = 4;             //idle symbols between two steps, the receiver gets ready for the next period in them
+const uint32_t REPORT_REPEATS = 6;              //the result goes to the partner this often, one has to make it
+
+
+
+inline bool loadProfile(const std::string & path, LinkOptions & options)      //settings a calibration measured, false if there is no profile
+{
+    std::ifstream file(path);
+    if(!file)
+    {
+        return false;
+    }
+    std::string line;
+    while(std::getline(file, line))
+    {
+        std::istringstream fields(line);
+        std::string key;
+        uint32_t value;
+        if(!(fields >> key >> value) || key[0] == '#')
+        {
+            continue;
+        }
+        if(key == "min_period_us")
+        {
+            options.min_period_us = value;
+        }
+        else if(key == "sample_phase")
+        {
+            options.sample_phase = value;
+        }
+    }
+    return true;
+}
+
+
+
+inline std::vector<uint8_t> prbsNibbles(size_t count)       //PRBS-7 (x^7 + x^6 + 1) on every line, each line at its own offset into the sequence
+{
+    uint8_t registers[4] = {0x7F, 0x1D, 0x52, 0x33};
+    std::vector<uint8_t> nibbles(count);
+    for(uint8_t & nibble : nibbles)
+    {
+        for(uint8_t line = 0; line < 4; line++)
+        {
+            uint8_t bit = ((registers[line] >> 6) ^ (registers[line] >> 5)) & 1;
+            registers[line] = static_cast<uint8_t>(((registers[line] << 1) | bit) & 0x7F);
+            nibble |= bit << line;
+        }
+    }
+    return nibbles;
+}
+
+
+
+struct SweepStep            //what one period of the sweep looked like on our receive lines
+{
+    uint32_t period_us;
+    bool captured = false;                                                      //the lead-in of the step was found
+    std::array<std::array<uint32_t, CALIBRATION_PHASES>, 4> errors{};          //wrong bits per line and sampling phase
+
+    std::pair<uint32_t, uint32_t> eye(uint32_t line_mask) const     //first phase and width of the longest run of phases without an error on every line in line_mask
+    {
+        std::pair<uint32_t, uint32_t> best{0, 0};
+        uint32_t run = 0;
+        for(uint32_t phase = 0; phase < CALIBRATION_PHASES; phase++)
+        {
+            bool clean = captured;
+            for(uint8_t line = 0; line < 4; line++)
+            {
+                clean = clean && (!(line_mask >> line & 1) || errors[line][phase] == 0);
+            }
+            run = clean ? run + 1 : 0;
+            if(run > best.second)
+            {
+                best = {phase + 1 - run, run};
+            }
+        }
+        return best;
+    }
+};
+
+
+
+class Calibrator            //both peers run it at once: a handshake at the base period, PRBS on all four lines at every period of the sweep, then each tells the other what it reads cleanly
+{
+    private:
+    LinkScheduler & scheduler;
+    const LinkOptions & options;
+    FramedCoder coder;                  //the handshake and the report are ordinary framed groups
+    NibbleReader wire;
+    std::vector<uint32_t> periods;      //the sweep, slowest first
+    std::vector<uint8_t> pattern;
+    std::chrono::steady_clock::time_point next_write;
+    std::chrono::steady_clock::time_point next_sample;
+    std::atomic<uint32_t> tx_period_us;
+    std::atomic<uint32_t> rx_period_us;
+    std::atomic<bool> heard{false};                 //a handshake group of the partner came in
+    std::atomic<bool> acknowledged{false};          //the partner heard ours
+    std::atomic<bool> measured{false};              //our receive side is through the sweep, recommended_* are valid
+    std::atomic<bool> reported{false};              //the partner's report came in, partner_period_us is valid
+
+    public:
+    std::vector<SweepStep> steps;
+    uint32_t recommended_period_us = 0;             //shortest period our receive side read cleanly, and every one before it, 0 if none
+    uint32_t recommended_phase = 2;                 //centre of the eye at that period, in CALIBRATION_PHASES
+    uint32_t partner_period_us = 0;                 //the partner's recommended_period_us, what our transmit side may use
+
+    Calibrator(LinkScheduler & sch, const LinkOptions & opt)
+        : scheduler(sch), options(opt), pattern(prbsNibbles(PRBS_LENGTH)), tx_period_us(opt.base_period_us), rx_period_us(opt.base_period_us)
+    {
+        wire.sample = [this] { return readSample(rx_period_us.load()); };
+        wire.poll = [this] { return readSample(rx_period_us.load() / CALIBRATION_PHASES); };
+        wire.samples = [this](uint8_t* half_bytes, size_t count) { for(size_t i = 0; i < count; i++) { half_bytes[i] = readSample(rx_period_us.load()); } };
+        for(uint32_t period = opt.base_period_us; period >= std::max<uint32_t>(opt.min_period_us, 1); period = period * 3 / 4)
+        {
+            periods.push_back(period / PERIOD_UNIT_US * PERIOD_UNIT_US);
+        }
+    }
+
+
+
+    void transmit()
+    {
+        while(!heard.load())
+        {
+            writeGroup({0x16, 0x16, 0x16, 0x16});           //SYNC until the partner shows up
+        }
+        while(!acknowledged.load())
+        {
+            writeGroup({0x06, 0x06, 0x06, 0x06});           //ACK until the partner heard us as well
+        }
+        for(uint32_t i = 0; i < 3; i++)
+        {
+            writeGroup({0x06, 0x06, 0x06, 0x06});
+        }
+        writeGroup({0x02, 0x02, 0x02, 0x02});               //STX, the sweep follows right after it
+
+        for(uint32_t period : periods)
+        {
+            tx_period_us.store(period);
+            std::vector<uint8_t> step(CALIBRATION_GAP + 1, 0x0F);          //the gap and the lead-in
+            step.push_back(0x00);
+            step.insert(step.end(), pattern.begin(), pattern.end());
+            step.push_back(0x00);                           //lead-out
+            step.push_back(0x0F);
+            writeStep(step, period);
+        }
+
+        tx_period_us.store(options.base_period_us);
+        while(!measured.load())                             //the lines idle high until there is something to report
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(options.base_period_us));
+        }
+        uint16_t period = static_cast<uint16_t>(std::min<uint32_t>(recommended_period_us / PERIOD_UNIT_US, 0xFFFF));
+        uint8_t high = period >> 8;
+        uint8_t low = period & 0xFF;
+        for(uint32_t i = 0; i < REPORT_REPEATS; i++)
+        {
+            writeGroup({'C', high, low, static_cast<uint8_t>('C' ^ high ^ low ^ 0x5A)});
+        }
+    }
+
+
+
+    void receive()
+    {
+        std::array<uint8_t, BYTE_BETWEEN_SYNC> group;
+        while(!acknowledged.load())
+        {
+            coder.decodeGroup(wire, group.data());
+            bool sync = isGroupOf(group, 0x16);
+            bool ack = isGroupOf(group, 0x06);
+            heard.store(heard.load() || sync || ack);
+            acknowledged.store(ack);
+        }
+        do
+        {
+            coder.decodeGroup(wire, group.data());
+        }
+        while(!isGroupOf(group, 0x02));
+
+        for(uint32_t period : periods)
+        {
+            steps.push_back(captureStep(period));
+        }
+        recommend();
+        measured.store(true);
+
+        rx_period_us.store(options.base_period_us);
+        while(true)
+        {
+            coder.decodeGroup(wire, group.data());
+            if(group[0] == 'C' && group[3] == ('C' ^ group[1] ^ group[2] ^ 0x5A))
+            {
+                partner_period_us = ((group[1] << 8) | group[2]) * PERIOD_UNIT_US;
+                reported.store(true);
+                return;
+            }
+        }
+    }
+
+
+
+    bool partnerReported() const
+    {
+        return reported.load();
+    }
+
+
+
+    void report(std::ostream & out) const          //per line bit error rate at every sampling phase, the eye and the recommendation
+    {
+        out << "period ms  line  bit error rate per sampling phase (sixths of a symbol)        eye" << std::endl;
+        for(const SweepStep & step : steps)
+        {
+            for(uint8_t line = 0; line < 4; line++)
+            {
+                out << std::left << std::setw(11) << (line == 0 ? std::to_string(step.period_us / 1000.0).substr(0, 6) : "") << std::setw(6) << int(line);
+                for(uint32_t phase = 0; phase < CALIBRATION_PHASES; phase++)
+                {
+                    out << std::setw(10) << (step.captured ? std::to_string(double(step.errors[line][phase]) / PRBS_LENGTH).substr(0, 6) : "lost");
+                }
+                out << step.eye(1 << line).second << "/" << CALIBRATION_PHASES << std::endl;
+            }
+        }
+        if(recommended_period_us == 0)
+        {
+            out << "no period of the sweep was read cleanly" << std::endl;
+            return;
+        }
+        out << "our receive side: shortest clean period " << recommended_period_us << " us, sample phase " << recommended_phase << "/" << CALIBRATION_PHASES << std::endl;
+        out << "partner's receive side: " << (reported.load() ? std::to_string(partner_period_us) + " us" : std::string("no report")) << std::endl;
+    }
+
+
+
+    void saveProfile(const std::string & path) const       //the partner's result bounds our transmit period, ours places our samples
+    {
+        std::ofstream file(path);
+        file << "# written by -calibrate" << std::endl;
+        uint32_t period = reported.load() ? partner_period_us : recommended_period_us;      //without a report the link is taken to be symmetric
+        if(period != 0)
+        {
+            file << "min_period_us " << period << std::endl;
+        }
+        if(recommended_period_us != 0)
+        {
+            file << "sample_phase " << recommended_phase << std::endl;
+        }
+    }
+
+
+
+    private:
+    SweepStep captureStep(uint32_t period)          //finds the lead-in, then takes CALIBRATION_PHASES samples per symbol over the whole pattern
+    {
+        SweepStep step;
+        step.period_us = period;
+        rx_period_us.store(period);
+        uint32_t tick = period / CALIBRATION_PHASES;
+        size_t wait_limit = (CALIBRATION_GAP + 8) * CALIBRATION_PHASES;     //the partner's lead-in is due after the last lead-out and the gap, else the step got lost
+
+        uint8_t previous = readSample(tick);
+        size_t edge_wait = 0;
+        for(uint8_t current = readSample(tick); !(previous == 0x0F && current == 0x00); current = readSample(tick))
+        {
+            if(++edge_wait > wait_limit)
+            {
+                readSample(period * (PRBS_LENGTH + 2));     //let the pattern go by, the next lead-in comes after it
+                return step;
+            }
+            previous = current;
+        }
+        step.captured = true;
+
+        std::vector<uint8_t> samples((1 + PRBS_LENGTH) * CALIBRATION_PHASES);      //sample 0 is the poll that saw the edge
+        samples[0] = 0x00;
+        auto slot = next_sample;
+        for(size_t i = 1; i < samples.size(); i++, slot += std::chrono::microseconds(tick))
+        {
+            samples[i] = scheduler.read(slot);             //on a fixed grid from the edge, a late sample does not move the ones after it
+        }
+        next_sample = slot;
+        for(uint32_t k = 0; k < PRBS_LENGTH; k++)
+        {
+            for(uint32_t phase = 0; phase < CALIBRATION_PHASES; phase++)
+            {
+                uint8_t wrong = samples[(k + 1) * CALIBRATION_PHASES + phase] ^ pattern[k];
+                for(uint8_t line = 0; line < 4; line++)
+                {
+                    step.errors[line][phase] += (wrong >> line) & 1;
+                }
+            }
+        }
+        return step;
+    }
+
+
+
+    void recommend()            //the sweep down to the first period whose eye over all four lines is less than a third of a symbol wide, sampled in the centre of the last good one
+    {
+        for(const SweepStep & step : steps)
+        {
+            auto [first, width] = step.eye(0x0F);
+            if(width * 3 < CALIBRATION_PHASES)
+            {
+                return;
+            }
+            recommended_period_us = step.period_us;
+            recommended_phase = std::clamp<uint32_t>(first + width / 2, 1, CALIBRATION_PHASES - 1);     //the poll that saw the edge itself is gone by then
+        }
+    }
+
+
+
+    static bool isGroupOf(const std::array<uint8_t, BYTE_BETWEEN_SYNC> & group, uint8_t byte)
+    {
+        return std::all_of(group.begin(), group.end(), [byte](uint8_t b) { return b == byte; });
+    }
+
+
+
+    void writeGroup(std::array<uint8_t, BYTE_BETWEEN_SYNC> bytes)
+    {
+        std::vector<uint8_t> nibbles;
+        coder.encodeGroup(bytes.data(), nibbles);
+        for(uint8_t nibble : nibbles)
+        {
+            writeNibble(nibble);
+        }
+    }
+
+
+
+    void writeStep(const std::vector<uint8_t> & nibbles, uint32_t period)     //on a fixed grid, a late nibble does not move the ones after it
+    {
+        auto slot = std::max(next_write, std::chrono::steady_clock::now());
+        for(uint8_t nibble : nibbles)
+        {
+            scheduler.write(nibble, slot);
+            slot += std::chrono::microseconds(period);
+        }
+        next_write = slot;
+    }
+
+
+
+    void writeNibble(uint8_t half_byte)
+    {
+        auto slot = std::max(next_write, std::chrono::steady_clock::now());
+        next_write = slot + std::chrono::microseconds(tx_period_us.load());
+        scheduler.write(half_byte, slot);
+    }
+
+
+
+    uint8_t readSample(uint32_t length_us)
+    {
+        auto slot = std::max(next_sample, std::chrono::steady_clock::now());
+        next_sample = slot + std::chrono::microseconds(length_us);
+        return scheduler.read(slot);
+    }
+};
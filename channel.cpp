@@ -0,0 +1,100 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <optional>
+#include <thread>
+#include <unordered_map>
+#include <iterator>
+
+
+
+template <typename T, size_t CAPACITY = 1024>
+class Channel           //lock-free single producer single consumer ring, one thread pushes and one pops
+{
+    static_assert((CAPACITY & (CAPACITY - 1)) == 0, "CAPACITY has to be a power of two");
+
+    protected:
+    T slots[CAPACITY];
+    alignas(64) std::atomic<uint64_t> head{0};      //next slot the producer fills, only the producer writes it
+    alignas(64) std::atomic<uint64_t> tail{0};      //next slot the consumer takes, only the consumer writes it
+
+    public:
+    void push(const T & value)          //producer: never drops, waits for the consumer if the ring is full
+    {
+        uint64_t position = head.load(std::memory_order_relaxed);
+        while(position - this->tail.load(std::memory_order_acquire) >= CAPACITY)
+        {
+            std::this_thread::yield();
+        }
+        slots[position & (CAPACITY - 1)] = value;
+        head.store(position + 1, std::memory_order_release);
+    }
+
+
+
+    std::optional<T> pop()              //consumer
+    {
+        uint64_t position = tail.load(std::memory_order_relaxed);
+        if(position == head.load(std::memory_order_acquire))
+        {
+            return std::nullopt;
+        }
+        T value = slots[position & (CAPACITY - 1)];
+        tail.store(position + 1, std::memory_order_release);
+        return value;
+    }
+
+
+
+    size_t size() const                 //either side, wait-free, a snapshot
+    {
+        uint64_t taken = this->tail.load(std::memory_order_acquire);
+        return static_cast<size_t>(head.load(std::memory_order_acquire) - taken);
+    }
+
+
+
+    bool empty() const
+    {
+        return size() == 0;
+    }
+};
+
+
+
+template <typename T, size_t CAPACITY = 1024>
+class UniqueChannel : public Channel<T, CAPACITY>      //a value is queued at most once at a time, like the sequence numbers in ack_queue
+{
+    private:
+    std::unordered_map<T, uint64_t> pushed;         //producer only: slot every value went into last
+
+    public:
+    bool pushUnique(const T & value)    //producer: false if value is still waiting in the ring
+    {
+        auto found = pushed.find(value);
+        if(found != pushed.end() && found->second >= this->tail.load(std::memory_order_acquire))        //the consumer has not taken it yet
+        {
+            return false;
+        }
+        if(pushed.size() >= 2 * CAPACITY)
+        {
+            forgetTaken();
+        }
+        pushed[value] = this->head.load(std::memory_order_relaxed);
+        this->push(value);
+        return true;
+    }
+
+
+
+    private:
+    void forgetTaken()          //producer: drops what the consumer already took from pushed
+    {
+        uint64_t taken = this->tail.load(std::memory_order_acquire);
+        for(auto it = pushed.begin(); it != pushed.end();)
+        {
+            it = it->second < taken ? pushed.erase(it) : std::next(it);
+        }
+    }
+};
@@ -0,0 +1,106 @@
+#pragma once
+#include "netkitten.cpp"
+
+
+
+class ClockRecovery         //software DPLL over an oversampled nibble stream: majority vote in the middle of every symbol, every edge pulls the symbol grid towards itself
+{
+    public:
+    static constexpr uint32_t MAX_PER_SYMBOL = 16;
+
+    private:
+    static constexpr double PHASE_GAIN = 0.5;           //share of an edge's offset the grid moves by at once
+    static constexpr double FREQUENCY_GAIN = 0.02;      //share that goes into the symbol length, which is kept from group to group
+    static constexpr double MAX_SKEW = 0.25;            //the partner's clock is never assumed further off than this
+
+    uint32_t per_symbol;
+    double symbol_length;           //samples one of the partner's symbols lasts, per_symbol if both clocks agree
+
+    public:
+    explicit ClockRecovery(uint32_t samples_per_symbol)
+        : per_symbol(std::clamp<uint32_t>(samples_per_symbol, 1, MAX_PER_SYMBOL)), symbol_length(per_symbol)
+    {
+
+    }
+
+
+
+    uint32_t perSymbol() const
+    {
+        return per_symbol;
+    }
+
+
+
+    size_t samplesFor(size_t symbols) const         //one symbol of slack for a partner that is slower than us
+    {
+        return (symbols + 1) * per_symbol;
+    }
+
+
+
+    void decode(const uint8_t* samples, size_t count, double start, uint8_t* symbols, size_t symbol_count)     //symbol 0 begins start samples in, its edge was already found by the caller
+    {
+        double position = start;
+        for(size_t k = 0; k < symbol_count; k++)
+        {
+            double error;
+            if(k > 0 && findEdge(samples, count, position, symbols[k - 1], error))
+            {
+                position += PHASE_GAIN * error;
+                symbol_length = std::clamp(symbol_length + FREQUENCY_GAIN * error, per_symbol * (1 - MAX_SKEW), per_symbol * (1 + MAX_SKEW));
+            }
+            symbols[k] = vote(samples, count, position);
+            position += symbol_length;
+        }
+    }
+
+
+
+    private:
+    bool findEdge(const uint8_t* samples, size_t count, double position, uint8_t previous, double & error) const     //where the symbol after previous really began, relative to position
+    {
+        long from = std::max<long>(1, std::lround(position - symbol_length / 2));
+        long to = std::min<long>(long(count) - 1, std::lround(position + symbol_length / 2) + 1);
+        for(long i = from; i < to; i++)
+        {
+            bool changed = samples[i] != previous && samples[i - 1] == previous;
+            bool settled = per_symbol < 3 || samples[i + 1] == samples[i];        //a single odd sample is a glitch and not an edge
+            if(changed && settled)
+            {
+                error = i - 0.5 - position;     //it happened between the two samples
+                return true;
+            }
+        }
+        return false;                       //same symbol again, nothing to track
+    }
+
+
+
+    uint8_t vote(const uint8_t* samples, size_t count, double position) const      //every line decided on its own over the middle half of the symbol, a tie goes to the sample in the centre
+    {
+        long centre = std::clamp<long>(std::lround(position + symbol_length / 2), 0, long(count) - 1);
+        long from = std::max<long>(0, std::ceil(position + symbol_length / 4));
+        long to = std::min<long>(long(count) - 1, std::floor(position + symbol_length * 3 / 4));
+        if(from > to)
+        {
+            return samples[centre];
+        }
+
+        uint8_t symbol = 0;
+        for(uint8_t line = 0; line < 4; line++)
+        {
+            long ones = 0;
+            for(long i = from; i <= to; i++)
+            {
+                ones += (samples[i] >> line) & 1;
+            }
+            long votes = to - from + 1;
+            if(2 * ones > votes || (2 * ones == votes && ((samples[centre] >> line) & 1)))
+            {
+                symbol |= 1 << line;
+            }
+        }
+        return symbol;
+    }
+};
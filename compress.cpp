@@ -0,0 +1,312 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <zlib.h>
+
+
+
+enum class Compression : uint8_t
+{
+    Off = 0,
+    Fast = 1,           //LZ4 style block format, every block on its own
+    Strong = 2,         //deflate with one dictionary for the whole session
+};
+
+
+
+const size_t COMPRESS_BLOCK = 1024;         //most input bytes that go into one block, output waits for a whole block
+const uint8_t BLOCK_STORED = 0;
+const uint8_t BLOCK_FAST = 1;
+const uint8_t BLOCK_STRONG = 2;
+const size_t BLOCK_HEADER = 5;              //mode, 2 byte input length, 2 byte stored length
+
+
+
+inline void lzCompress(const uint8_t* data, size_t length, std::vector<uint8_t> & out)      //greedy LZ77 in the LZ4 block layout: token, literals, 2 byte offset
+{
+    const size_t MIN_MATCH = 4;
+    const size_t HASH_BITS = 12;
+    std::vector<uint32_t> table(size_t(1) << HASH_BITS, uint32_t(~0));
+    auto hash = [&](size_t i)
+    {
+        uint32_t sequence;
+        std::memcpy(&sequence, data + i, 4);
+        return (sequence * 2654435761u) >> (32 - HASH_BITS);
+    };
+    auto putLength = [&](size_t rest)           //lengths past 15 continue in bytes of up to 255
+    {
+        while(rest >= 255)
+        {
+            out.push_back(255);
+            rest -= 255;
+        }
+        out.push_back(static_cast<uint8_t>(rest));
+    };
+
+    size_t anchor = 0;
+    size_t i = 0;
+    while(i + MIN_MATCH <= length)
+    {
+        uint32_t & slot = table[hash(i)];
+        size_t candidate = slot;
+        slot = static_cast<uint32_t>(i);
+        if(candidate == uint32_t(~0) || i - candidate > 0xFFFF || std::memcmp(data + candidate, data + i, MIN_MATCH) != 0)
+        {
+            i++;
+            continue;
+        }
+
+        size_t match = MIN_MATCH;
+        while(i + match < length && data[candidate + match] == data[i + match])
+        {
+            match++;
+        }
+        size_t literals = i - anchor;
+        out.push_back(static_cast<uint8_t>((std::min<size_t>(literals, 15) << 4) | std::min<size_t>(match - MIN_MATCH, 15)));
+        if(literals >= 15)
+        {
+            putLength(literals - 15);
+        }
+        out.insert(out.end(), data + anchor, data + i);
+        size_t offset = i - candidate;
+        out.push_back(static_cast<uint8_t>(offset));
+        out.push_back(static_cast<uint8_t>(offset >> 8));
+        if(match - MIN_MATCH >= 15)
+        {
+            putLength(match - MIN_MATCH - 15);
+        }
+        i += match;
+        anchor = i;
+    }
+
+    size_t literals = length - anchor;          //the last sequence only has literals
+    out.push_back(static_cast<uint8_t>(std::min<size_t>(literals, 15) << 4));
+    if(literals >= 15)
+    {
+        putLength(literals - 15);
+    }
+    out.insert(out.end(), data + anchor, data + length);
+}
+
+
+
+inline bool lzDecompress(const uint8_t* data, size_t length, size_t expected, std::vector<uint8_t> & out)      //false if the block is malformed
+{
+    size_t begin = out.size();
+    size_t i = 0;
+    auto getLength = [&](size_t value, bool & ok)
+    {
+        if(value < 15)
+        {
+            return value;
+        }
+        uint8_t more;
+        do
+        {
+            if(i >= length)
+            {
+                ok = false;
+                return value;
+            }
+            more = data[i++];
+            value += more;
+        } while(more == 255);
+        return value;
+    };
+
+    while(i < length)
+    {
+        bool ok = true;
+        uint8_t token = data[i++];
+        size_t literals = getLength(token >> 4, ok);
+        if(!ok || literals > length - i)
+        {
+            return false;
+        }
+        out.insert(out.end(), data + i, data + i + literals);
+        i += literals;
+        if(i == length)
+        {
+            break;                              //last sequence
+        }
+        if(length - i < 2)
+        {
+            return false;
+        }
+        size_t offset = data[i] | (data[i + 1] << 8);
+        i += 2;
+        size_t match = getLength(token & 0x0F, ok) + 4;
+        if(!ok || offset == 0 || offset > out.size() - begin)
+        {
+            return false;
+        }
+        for(size_t k = 0; k < match; k++)       //byte by byte, a match may overlap what it copies
+        {
+            out.push_back(out[out.size() - offset]);
+        }
+    }
+    return out.size() - begin == expected;
+}
+
+
+
+inline bool looksCompressed(const uint8_t* data, size_t length)       //zip, gzip, bzip2, xz, zstd, 7z, png, jpeg: compressing again only costs time
+{
+    static const std::vector<std::vector<uint8_t>> magics = {
+        {'P', 'K', 0x03, 0x04}, {0x1F, 0x8B}, {'B', 'Z', 'h'}, {0xFD, '7', 'z', 'X', 'Z'},
+        {0x28, 0xB5, 0x2F, 0xFD}, {'7', 'z', 0xBC, 0xAF}, {0x89, 'P', 'N', 'G'}, {0xFF, 0xD8, 0xFF},
+    };
+    for(const std::vector<uint8_t> & magic : magics)
+    {
+        if(length >= magic.size() && std::equal(magic.begin(), magic.end(), data))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+
+class StreamCompressor      //turns input chunks into self describing blocks, Strong keeps its dictionary from block to block
+{
+    private:
+    Compression mode;
+    z_stream deflater{};
+    std::vector<uint8_t> scratch;
+
+    public:
+    explicit StreamCompressor(Compression m)
+        : mode(m)
+    {
+        if(mode == Compression::Strong)
+        {
+            deflateInit2(&deflater, Z_BEST_COMPRESSION, Z_DEFLATED, -15, 9, Z_DEFAULT_STRATEGY);       //raw deflate, the block header replaces the zlib one
+        }
+    }
+
+    ~StreamCompressor()
+    {
+        if(mode == Compression::Strong)
+        {
+            deflateEnd(&deflater);
+        }
+    }
+
+    StreamCompressor(const StreamCompressor &) = delete;
+    StreamCompressor & operator=(const StreamCompressor &) = delete;
+
+
+
+    void compress(const uint8_t* data, size_t length, std::vector<uint8_t> & out)     //appends one block per COMPRESS_BLOCK of input
+    {
+        for(size_t done = 0; done < length; done += COMPRESS_BLOCK)
+        {
+            size_t part = std::min(COMPRESS_BLOCK, length - done);
+            scratch.clear();
+            uint8_t block_mode = BLOCK_STORED;
+            if(mode == Compression::Strong)
+            {
+                scratch.resize(deflateBound(&deflater, part) + 16);
+                deflater.next_in = const_cast<uint8_t*>(data + done);
+                deflater.avail_in = static_cast<uInt>(part);
+                deflater.next_out = scratch.data();
+                deflater.avail_out = static_cast<uInt>(scratch.size());
+                deflate(&deflater, Z_SYNC_FLUSH);       //everything fed so far can be decoded, the dictionary stays
+                scratch.resize(scratch.size() - deflater.avail_out);
+                block_mode = BLOCK_STRONG;              //never stored: the receiver's dictionary has to see every byte the deflater saw
+            }
+            else if(mode == Compression::Fast)
+            {
+                lzCompress(data + done, part, scratch);
+                block_mode = scratch.size() < part ? BLOCK_FAST : BLOCK_STORED;
+            }
+            if(block_mode == BLOCK_STORED)
+            {
+                scratch.assign(data + done, data + done + part);
+            }
+
+            out.push_back(block_mode);
+            out.push_back(static_cast<uint8_t>(part >> 8));
+            out.push_back(static_cast<uint8_t>(part));
+            out.push_back(static_cast<uint8_t>(scratch.size() >> 8));
+            out.push_back(static_cast<uint8_t>(scratch.size()));
+            out.insert(out.end(), scratch.begin(), scratch.end());
+        }
+    }
+};
+
+
+
+class StreamDecompressor    //collects bytes until a block is complete and decodes it
+{
+    private:
+    std::vector<uint8_t> pending;
+    z_stream inflater{};
+    bool broken = false;
+
+    public:
+    StreamDecompressor()
+    {
+        inflateInit2(&inflater, -15);
+    }
+
+    ~StreamDecompressor()
+    {
+        inflateEnd(&inflater);
+    }
+
+    StreamDecompressor(const StreamDecompressor &) = delete;
+    StreamDecompressor & operator=(const StreamDecompressor &) = delete;
+
+
+
+    bool feed(const uint8_t* data, size_t length, std::vector<uint8_t> & out)        //appends every block completed by data, false once the stream is corrupt
+    {
+        pending.insert(pending.end(), data, data + length);
+        size_t used = 0;
+        while(!broken && pending.size() - used >= BLOCK_HEADER)
+        {
+            const uint8_t* block = pending.data() + used;
+            size_t expected = (block[1] << 8) | block[2];
+            size_t stored = (block[3] << 8) | block[4];
+            if(pending.size() - used < BLOCK_HEADER + stored)
+            {
+                break;
+            }
+            const uint8_t* body = block + BLOCK_HEADER;
+
+            if(block[0] == BLOCK_STORED && stored == expected)
+            {
+                out.insert(out.end(), body, body + stored);
+            }
+            else if(block[0] == BLOCK_FAST)
+            {
+                broken = !lzDecompress(body, stored, expected, out);
+            }
+            else if(block[0] == BLOCK_STRONG)
+            {
+                size_t begin = out.size();
+                out.resize(begin + expected + 1);       //one spare byte so the flush marker at the end gets consumed too
+                inflater.next_in = const_cast<uint8_t*>(body);
+                inflater.avail_in = static_cast<uInt>(stored);
+                inflater.next_out = out.data() + begin;
+                inflater.avail_out = static_cast<uInt>(expected + 1);
+                int result = inflate(&inflater, Z_SYNC_FLUSH);
+                size_t produced = expected + 1 - inflater.avail_out;
+                out.resize(begin + produced);
+                broken = (result != Z_OK && result != Z_BUF_ERROR) || produced != expected || inflater.avail_in != 0;
+            }
+            else
+            {
+                broken = true;
+            }
+            used += BLOCK_HEADER + stored;
+        }
+        pending.erase(pending.begin(), pending.begin() + used);
+        return !broken;
+    }
+};
@@ -0,0 +1,178 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#endif
+
+
+
+enum class ChecksumType : uint8_t
+{
+    Crc16 = 1,          //CRC-16-CCITT, polynomial 0x1021, initial 0xFFFF
+    Crc32c = 2,         //CRC-32C (Castagnoli), polynomial 0x1EDC6F41 reflected
+};
+
+
+
+constexpr std::array<std::array<uint16_t, 256>, 4> makeCrc16Tables()       //table k advances a byte through k+1 byte steps
+{
+    std::array<std::array<uint16_t, 256>, 4> tables{};
+    for(uint32_t value = 0; value < 256; value++)
+    {
+        uint16_t crc = static_cast<uint16_t>(value << 8);
+        for(int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 0x8000) ? static_cast<uint16_t>((crc << 1) ^ 0x1021) : static_cast<uint16_t>(crc << 1);
+        }
+        tables[0][value] = crc;
+    }
+    for(size_t k = 1; k < 4; k++)
+    {
+        for(uint32_t value = 0; value < 256; value++)
+        {
+            uint16_t previous = tables[k-1][value];
+            tables[k][value] = static_cast<uint16_t>((previous << 8) ^ tables[0][previous >> 8]);
+        }
+    }
+    return tables;
+}
+
+
+
+constexpr std::array<std::array<uint32_t, 256>, 8> makeCrc32cTables()
+{
+    std::array<std::array<uint32_t, 256>, 8> tables{};
+    for(uint32_t value = 0; value < 256; value++)
+    {
+        uint32_t crc = value;
+        for(int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 1) ? (crc >> 1) ^ 0x82F63B78 : crc >> 1;
+        }
+        tables[0][value] = crc;
+    }
+    for(size_t k = 1; k < 8; k++)
+    {
+        for(uint32_t value = 0; value < 256; value++)
+        {
+            uint32_t previous = tables[k-1][value];
+            tables[k][value] = (previous >> 8) ^ tables[0][previous & 0xFF];
+        }
+    }
+    return tables;
+}
+
+
+
+inline constexpr auto CRC16_TABLES = makeCrc16Tables();
+inline constexpr auto CRC32C_TABLES = makeCrc32cTables();
+
+
+
+inline uint16_t crc16Bytewise(const uint8_t* data, size_t length, uint16_t crc = 0xFFFF)
+{
+    for(size_t i = 0; i < length; i++)
+    {
+        crc = static_cast<uint16_t>((crc << 8) ^ CRC16_TABLES[0][(crc >> 8) ^ data[i]]);
+    }
+    return crc;
+}
+
+
+
+inline uint16_t crc16(const uint8_t* data, size_t length, uint16_t crc = 0xFFFF)      //slice-by-4, continue a running CRC by passing it as crc
+{
+    while(length >= 4)
+    {
+        uint16_t high = static_cast<uint16_t>(crc ^ ((data[0] << 8) | data[1]));
+        crc = CRC16_TABLES[3][high >> 8] ^ CRC16_TABLES[2][high & 0xFF] ^ CRC16_TABLES[1][data[2]] ^ CRC16_TABLES[0][data[3]];
+        data += 4;
+        length -= 4;
+    }
+    return crc16Bytewise(data, length, crc);
+}
+
+
+
+inline uint32_t crc32cBytewise(const uint8_t* data, size_t length, uint32_t crc = 0)
+{
+    crc = ~crc;
+    for(size_t i = 0; i < length; i++)
+    {
+        crc = (crc >> 8) ^ CRC32C_TABLES[0][(crc ^ data[i]) & 0xFF];
+    }
+    return ~crc;
+}
+
+
+
+inline uint32_t crc32cSliced(const uint8_t* data, size_t length, uint32_t crc = 0)       //slice-by-8
+{
+    crc = ~crc;
+    while(length >= 8)
+    {
+        uint32_t low = crc ^ (data[0] | (data[1] << 8) | (data[2] << 16) | (uint32_t(data[3]) << 24));
+        crc = CRC32C_TABLES[7][low & 0xFF] ^ CRC32C_TABLES[6][(low >> 8) & 0xFF] ^ CRC32C_TABLES[5][(low >> 16) & 0xFF] ^ CRC32C_TABLES[4][low >> 24]
+            ^ CRC32C_TABLES[3][data[4]] ^ CRC32C_TABLES[2][data[5]] ^ CRC32C_TABLES[1][data[6]] ^ CRC32C_TABLES[0][data[7]];
+        data += 8;
+        length -= 8;
+    }
+    while(length--)
+    {
+        crc = (crc >> 8) ^ CRC32C_TABLES[0][(crc ^ *data++) & 0xFF];
+    }
+    return ~crc;
+}
+
+
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+inline uint32_t crc32cHardware(const uint8_t* data, size_t length, uint32_t crc = 0)    //SSE4.2 crc32 instruction
+{
+    uint64_t state = ~crc;
+    while(length >= 8)
+    {
+        uint64_t chunk;
+        __builtin_memcpy(&chunk, data, 8);
+        state = _mm_crc32_u64(state, chunk);
+        data += 8;
+        length -= 8;
+    }
+    uint32_t rest = static_cast<uint32_t>(state);
+    while(length--)
+    {
+        rest = _mm_crc32_u8(rest, *data++);
+    }
+    return ~rest;
+}
+
+
+
+inline bool crc32cHardwareAvailable()
+{
+    static const bool available = __builtin_cpu_supports("sse4.2");
+    return available;
+}
+#else
+inline uint32_t crc32cHardware(const uint8_t* data, size_t length, uint32_t crc = 0)
+{
+    return crc32cSliced(data, length, crc);
+}
+
+
+
+inline bool crc32cHardwareAvailable()
+{
+    return false;
+}
+#endif
+
+
+
+inline uint32_t crc32c(const uint8_t* data, size_t length, uint32_t crc = 0)     //picks the hardware path when the CPU has one
+{
+    return crc32cHardwareAvailable() ? crc32cHardware(data, length, crc) : crc32cSliced(data, length, crc);
+}
@@ -0,0 +1,227 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <algorithm>
+
+
+
+class ReedSolomon       //systematic RS code over GF(256), corrects up to parity/2 wrong bytes in a codeword of at most 255 bytes
+{
+    private:
+    uint8_t exp_table[512];
+    uint8_t log_table[256];
+    std::vector<uint8_t> generator;         //highest power first, generator[0] == 1
+    size_t parity;
+
+    public:
+    explicit ReedSolomon(size_t parity_bytes)
+        : parity(parity_bytes)
+    {
+        uint32_t value = 1;
+        for(int i = 0; i < 255; i++)        //powers of the primitive element for polynomial 0x11D
+        {
+            exp_table[i] = static_cast<uint8_t>(value);
+            log_table[value] = static_cast<uint8_t>(i);
+            value <<= 1;
+            if(value & 0x100)
+            {
+                value ^= 0x11D;
+            }
+        }
+        for(int i = 255; i < 512; i++)
+        {
+            exp_table[i] = exp_table[i - 255];
+        }
+        log_table[0] = 0;
+
+        generator = {1};
+        for(size_t i = 0; i < parity; i++)  //product of (x - a^i)
+        {
+            std::vector<uint8_t> next(generator.size() + 1, 0);
+            for(size_t j = 0; j < generator.size(); j++)
+            {
+                next[j] ^= generator[j];
+                next[j + 1] ^= mul(generator[j], exp_table[i]);
+            }
+            generator = next;
+        }
+    }
+
+
+
+    uint8_t mul(uint8_t a, uint8_t b) const
+    {
+        if(a == 0 || b == 0)
+        {
+            return 0;
+        }
+        return exp_table[log_table[a] + log_table[b]];
+    }
+
+
+
+    uint8_t div(uint8_t a, uint8_t b) const
+    {
+        if(a == 0)
+        {
+            return 0;
+        }
+        return exp_table[(log_table[a] + 255 - log_table[b]) % 255];
+    }
+
+
+
+    uint8_t power(int exponent) const       //a^exponent, exponent may be negative
+    {
+        return exp_table[((exponent % 255) + 255) % 255];
+    }
+
+
+
+    size_t parityBytes() const
+    {
+        return parity;
+    }
+
+
+
+    void encode(const uint8_t* data, size_t length, uint8_t* parity_out) const     //remainder of data * x^parity divided by the generator
+    {
+        std::fill(parity_out, parity_out + parity, 0);
+        for(size_t i = 0; i < length; i++)
+        {
+            uint8_t feedback = data[i] ^ parity_out[0];
+            std::copy(parity_out + 1, parity_out + parity, parity_out);
+            parity_out[parity - 1] = 0;
+            if(feedback != 0)
+            {
+                for(size_t j = 0; j < parity; j++)
+                {
+                    parity_out[j] ^= mul(generator[j + 1], feedback);
+                }
+            }
+        }
+    }
+
+
+
+    int decode(uint8_t* codeword, size_t length) const     //corrects in place, returns the number of fixed bytes or -1 if there were too many
+    {
+        //byte i of the codeword is the coefficient of x^(length-1-i)
+        std::vector<uint8_t> syndromes(parity, 0);
+        bool clean = true;
+        for(size_t j = 0; j < parity; j++)
+        {
+            uint8_t sum = 0;
+            for(size_t i = 0; i < length; i++)
+            {
+                sum = mul(sum, exp_table[j]) ^ codeword[i];
+            }
+            syndromes[j] = sum;
+            clean = clean && sum == 0;
+        }
+        if(clean)
+        {
+            return 0;
+        }
+
+        //Berlekamp-Massey, locator lowest power first
+        std::vector<uint8_t> locator = {1};
+        std::vector<uint8_t> previous = {1};
+        size_t errors = 0;
+        size_t shift = 1;
+        uint8_t previous_discrepancy = 1;
+        for(size_t n = 0; n < parity; n++)
+        {
+            uint8_t discrepancy = syndromes[n];
+            for(size_t i = 1; i <= errors && i < locator.size(); i++)
+            {
+                discrepancy ^= mul(locator[i], syndromes[n - i]);
+            }
+            if(discrepancy == 0)
+            {
+                shift++;
+                continue;
+            }
+
+            std::vector<uint8_t> saved = locator;
+            uint8_t scale = div(discrepancy, previous_discrepancy);
+            if(locator.size() < previous.size() + shift)
+            {
+                locator.resize(previous.size() + shift, 0);
+            }
+            for(size_t i = 0; i < previous.size(); i++)
+            {
+                locator[i + shift] ^= mul(scale, previous[i]);
+            }
+
+            if(2 * errors <= n)
+            {
+                errors = n + 1 - errors;
+                previous = saved;
+                previous_discrepancy = discrepancy;
+                shift = 1;
+            }
+            else
+            {
+                shift++;
+            }
+        }
+        locator.resize(errors + 1);
+        if(2 * errors > parity)
+        {
+            return -1;
+        }
+
+        //Chien search: an error at power k makes a^-k a root of the locator
+        std::vector<size_t> positions;
+        for(size_t k = 0; k < length; k++)
+        {
+            uint8_t sum = 0;
+            uint8_t root = power(-static_cast<int>(k));
+            for(size_t i = locator.size(); i-- > 0;)
+            {
+                sum = mul(sum, root) ^ locator[i];
+            }
+            if(sum == 0)
+            {
+                positions.push_back(k);
+            }
+        }
+        if(positions.size() != errors)
+        {
+            return -1;
+        }
+
+        //Forney: evaluator = syndromes * locator mod x^parity, first root is a^0
+        std::vector<uint8_t> evaluator(parity, 0);
+        for(size_t i = 0; i < parity; i++)
+        {
+            for(size_t j = 0; j < locator.size() && j <= i; j++)
+            {
+                evaluator[i] ^= mul(syndromes[i - j], locator[j]);
+            }
+        }
+        for(size_t k : positions)
+        {
+            uint8_t inverse = power(-static_cast<int>(k));
+            uint8_t numerator = 0;
+            for(size_t i = evaluator.size(); i-- > 0;)
+            {
+                numerator = mul(numerator, inverse) ^ evaluator[i];
+            }
+            uint8_t denominator = 0;            //formal derivative keeps the odd powers
+            for(size_t i = 1; i < locator.size(); i += 2)
+            {
+                denominator ^= mul(locator[i], power(-static_cast<int>(k * (i - 1))));
+            }
+            if(denominator == 0)
+            {
+                return -1;
+            }
+            codeword[length - 1 - k] ^= mul(power(static_cast<int>(k)), div(numerator, denominator));
+        }
+        return static_cast<int>(errors);
+    }
+};
@@ -0,0 +1,161 @@
+#pragma once
+#include "netkitten.cpp"
+#include <stdexcept>
+
+
+
+struct HeaderField          //where a big endian value sits in a stack
+{
+    uint32_t position;
+    uint32_t width;
+};
+
+constexpr HeaderField FIELD_FORMAT{POS_FORMAT, 1};
+constexpr HeaderField FIELD_SEQUENCE{POS_SEQUENCE, 4};
+constexpr HeaderField FIELD_ACK_TYPE{POS_ACK_TYPE, 1};
+constexpr HeaderField FIELD_CUMULATIVE_ACK{POS_CUMULATIVE_ACK, 4};
+constexpr HeaderField FIELD_SACK{POS_SACK, 4};
+constexpr HeaderField FIELD_NAK{POS_NAK, 4};
+constexpr HeaderField FIELD_LENGTH{POS_LENGTH, 1};
+constexpr HeaderField FIELD_WINDOW{POS_WINDOW, 1};
+constexpr HeaderField FIELD_CAPS{POS_CAPS, 1};
+constexpr HeaderField FIELD_PERIOD{POS_PERIOD, 2};
+constexpr HeaderField FIELD_PERIOD_ECHO{POS_PERIOD_ECHO, 2};
+constexpr HeaderField FIELD_CHECKSUM{POS_CHECKSUM, 4};
+
+constexpr HeaderField HEADER_LAYOUT[] = {FIELD_FORMAT, FIELD_SEQUENCE, FIELD_ACK_TYPE, FIELD_CUMULATIVE_ACK, FIELD_SACK, FIELD_NAK,
+                                         FIELD_LENGTH, FIELD_WINDOW, FIELD_CAPS, FIELD_PERIOD, FIELD_PERIOD_ECHO, FIELD_CHECKSUM};
+
+constexpr bool headerIsPacked()             //every field follows the one before without a gap, from after the SOH up to the STX
+{
+    uint32_t next = 1;
+    for(const HeaderField & field : HEADER_LAYOUT)
+    {
+        if(field.position != next)
+        {
+            return false;
+        }
+        next += field.width;
+    }
+    return next == POS_TEXT;
+}
+static_assert(headerIsPacked(), "the POS_ constants and HEADER_LAYOUT disagree");
+static_assert(POS_TEXT + 1 + BYTE_PER_PACKAGE + 1 == HEADER_SIZE + BYTE_PER_PACKAGE, "STX, payload and ETX have to fill the stack");
+
+
+
+inline void putField(uint8_t* stack, HeaderField field, uint32_t value)
+{
+    for(uint32_t i = 0; i < field.width; i++)
+    {
+        stack[field.position + i] = static_cast<uint8_t>(value >> (8 * (field.width - 1 - i)));
+    }
+}
+
+
+
+inline uint32_t getField(const uint8_t* stack, HeaderField field)
+{
+    uint32_t value = 0;
+    for(uint32_t i = 0; i < field.width; i++)
+    {
+        value = (value << 8) | stack[field.position + i];
+    }
+    return value;
+}
+
+
+
+struct Frame                // one stack built in place, FEC parity included
+{
+    std::array<uint8_t, HEADER_SIZE + BYTE_PER_PACKAGE + FEC_PARITY> bytes;
+    uint32_t sequence = uint32_t(~0);
+    bool used = false;
+
+    uint8_t* payload()
+    {
+        return bytes.data() + POS_TEXT + 1;
+    }
+};
+
+
+
+class FramePool             //every frame allocated up front: one slot per sequence number that can be unacknowledged at once, one for stacks without payload
+{
+    private:
+    static constexpr uint32_t SLOTS = 256;      //the partner's window is a byte, so unacknowledged sequence numbers never lie SLOTS apart
+    std::vector<Frame> frames;                  //SLOTS by sequence number, then the control frame
+
+    public:
+    FramePool()
+        : frames(SLOTS + 1)
+    {
+        prepare(control(), uint32_t(~0));
+    }
+
+
+
+    Frame & open(uint32_t sequence)             //a fresh frame for sequence, the caller fills the payload and its length
+    {
+        Frame & frame = frames[sequence % SLOTS];
+        if(frame.used)
+        {
+            throw std::logic_error("frame pool slot still holds an unacknowledged package");
+        }
+        prepare(frame, sequence);
+        frame.used = true;
+        return frame;
+    }
+
+
+
+    Frame * find(uint32_t sequence)
+    {
+        Frame & frame = frames[sequence % SLOTS];
+        return frame.used && frame.sequence == sequence ? &frame : nullptr;
+    }
+
+
+
+    void release(uint32_t sequence)             //the partner has it
+    {
+        if(Frame * frame = find(sequence))
+        {
+            frame->used = false;
+        }
+    }
+
+
+
+    template <typename Visit>
+    void forEachOpen(Visit visit)               //visit(frame) for every package not acknowledged yet
+    {
+        for(uint32_t slot = 0; slot < SLOTS; slot++)
+        {
+            if(frames[slot].used)
+            {
+                visit(frames[slot]);
+            }
+        }
+    }
+
+
+
+    Frame & control()                           //sequence ~0, an empty payload, only carries the header
+    {
+        return frames[SLOTS];
+    }
+
+
+
+    private:
+    static void prepare(Frame & frame, uint32_t sequence)       //the parts that never change between transmissions
+    {
+        frame.bytes.fill(0x00);
+        frame.bytes[0] = 0x01;                                  //start of heading
+        putField(frame.bytes.data(), FIELD_SEQUENCE, sequence);
+        frame.bytes[POS_TEXT] = 0x02;                           //start of text
+        frame.bytes[HEADER_SIZE + BYTE_PER_PACKAGE - 1] = 0x03;   //end of text
+        frame.sequence = sequence;
+    }
+};
@@ -0,0 +1,113 @@
+#pragma once
+#include "netkitten.cpp"
+#include "acktracker.cpp"
+
+
+
+class InFlight          //packages sent and not acknowledged yet, by sequence number for the window and by deadline for the retransmission timer
+{
+    private:
+    using TimePoint = std::chrono::steady_clock::time_point;
+
+    struct Package
+    {
+        TimePoint sent;                 //end of its last transmission
+        bool resent;                    //no RTT sample from it, see RttEstimator::sample
+        std::multimap<TimePoint, uint32_t>::iterator timer;
+    };
+
+    std::map<uint32_t, Package> packages;
+    std::multimap<TimePoint, uint32_t> deadlines;       //earliest first, erased through Package::timer when the ACK comes
+
+    public:
+    void sent(uint32_t sequence, TimePoint now, std::chrono::steady_clock::duration timeout)       //first transmission or a resend
+    {
+        auto found = packages.find(sequence);
+        if(found != packages.end())
+        {
+            deadlines.erase(found->second.timer);
+            found->second.sent = now;
+            found->second.resent = true;
+            found->second.timer = deadlines.emplace(now + timeout, sequence);
+            return;
+        }
+        packages.emplace(sequence, Package{now, false, deadlines.emplace(now + timeout, sequence)});
+    }
+
+
+
+    template <typename Acked>
+    void acknowledge(const AckReport & report, Acked acked)      //removes everything report covers, acked(sequence, sent once, sent at)
+    {
+        auto remove = [&](std::map<uint32_t, Package>::iterator it)
+        {
+            deadlines.erase(it->second.timer);
+            acked(it->first, !it->second.resent, it->second.sent);
+            return packages.erase(it);
+        };
+
+        for(auto it = packages.begin(); it != packages.end() && it->first < report.cumulative;)
+        {
+            it = remove(it);
+        }
+        for(uint32_t bits = report.bitmap; bits != 0; bits &= bits - 1)
+        {
+            auto it = packages.find(report.cumulative + 1 + __builtin_ctz(bits));
+            if(it != packages.end())
+            {
+                remove(it);
+            }
+        }
+    }
+
+
+
+    void restartTimers(TimePoint now, std::chrono::steady_clock::duration timeout)        //the partner could not acknowledge anything until now, every timer counts from here
+    {
+        deadlines.clear();
+        for(auto & [sequence, package] : packages)
+        {
+            package.sent = now;
+            package.timer = deadlines.emplace(now + timeout, sequence);
+        }
+    }
+
+
+
+    std::optional<uint32_t> expired(TimePoint now) const        //the package whose timer ran out first, if any did
+    {
+        if(deadlines.empty() || deadlines.begin()->first > now)
+        {
+            return std::nullopt;
+        }
+        return deadlines.begin()->second;
+    }
+
+
+
+    bool contains(uint32_t sequence) const
+    {
+        return packages.count(sequence) != 0;
+    }
+
+
+
+    std::optional<uint32_t> oldest() const
+    {
+        return packages.empty() ? std::nullopt : std::optional<uint32_t>(packages.begin()->first);
+    }
+
+
+
+    size_t size() const
+    {
+        return packages.size();
+    }
+
+
+
+    bool empty() const
+    {
+        return packages.empty();
+    }
+};
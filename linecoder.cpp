@@ -0,0 +1,349 @@
+#pragma once
+#include "netkitten.cpp"
+#include "clockrecovery.cpp"
+#include <memory>
+
+
+
+struct NibbleReader         //what a LineCoder needs from the receiver to look at the wire
+{
+    std::function<uint8_t()> sample;        //reads the lines and waits one symbol period
+    std::function<uint8_t()> poll;          //reads the lines and waits a sixth of a symbol period
+    std::function<void(uint8_t*, size_t)> samples;      //count reads one symbol period apart, in one go if the driver can batch them
+    std::function<void(uint8_t*, size_t, uint32_t)> oversamples;     //count reads a symbol period / per_symbol apart, the same way
+};
+
+
+
+class LineCoder             //turns a group of BYTE_BETWEEN_SYNC bytes into nibbles on the wire and back
+{
+    public:
+    virtual ~LineCoder() = default;
+
+    virtual void encodeGroup(const uint8_t* bytes, std::vector<uint8_t> & nibbles) = 0;       //appends the nibbles for one group, framing included
+    virtual bool decodeGroup(NibbleReader & wire, uint8_t* bytes) = 0;                       //waits for the next group, false if it could not be read cleanly
+    virtual const char* name() const = 0;
+    virtual double symbolsPerGroup() const = 0;                                              //nibbles one group takes on the wire, framing and markers averaged in
+};
+
+
+
+class FramedCoder : public LineCoder        //the original scheme: 12 nibbles per 4 bytes
+{
+    private:
+    std::optional<ClockRecovery> recovery;      //several samples per symbol instead of one, see decodeOversampled
+    uint32_t sample_phase;                      //polls from the edge to the first sample, see LinkOptions::sample_phase
+
+    public:
+    explicit FramedCoder(uint32_t oversampling = 1, uint32_t phase = 2)
+        : sample_phase(std::clamp<uint32_t>(phase, 1, 5))
+    {
+        if(oversampling > 1)
+        {
+            recovery.emplace(oversampling);
+        }
+    }
+
+
+
+    void encodeGroup(const uint8_t* bytes, std::vector<uint8_t> & nibbles) override
+    {
+        nibbles.push_back(0x0F);                //lead-in, the receiver waits for its falling edge
+        nibbles.push_back(0x00);
+        for(uint32_t i = 0; i < BYTE_BETWEEN_SYNC; i++)
+        {
+            nibbles.push_back(bytes[i] >> 4);
+            nibbles.push_back(bytes[i] & 0x0F);
+        }
+        nibbles.push_back(0x00);                //lead-out
+        nibbles.push_back(0x0F);
+    }
+
+
+
+    bool decodeGroup(NibbleReader & wire, uint8_t* bytes) override
+    {
+        if(recovery)
+        {
+            return decodeOversampled(wire, bytes);
+        }
+
+        uint8_t previous = 0xFF;
+        uint8_t current = wire.poll();
+        while(!(previous == 0x0F && current == 0x00))       //catch the falling edge of the lead-in
+        {
+            previous = current;
+            current = wire.poll();
+        }
+        for(uint32_t i = 1; i < sample_phase; i++)
+        {
+            wire.poll();        //move the samples away from the edge
+        }
+
+        uint8_t half_bytes[1 + 2 * BYTE_BETWEEN_SYNC];
+        wire.samples(half_bytes, sizeof(half_bytes));       //first read gets scrapped because its only for syncing purpouses
+        for(uint32_t i = 0; i < BYTE_BETWEEN_SYNC; i++)
+        {
+            bytes[i] = static_cast<uint8_t>(((half_bytes[1 + 2 * i] & 0x0F) << 4) | (half_bytes[2 + 2 * i] & 0x0F));
+        }
+        return true;
+    }
+
+
+
+    const char* name() const override
+    {
+        return "framed";
+    }
+
+
+
+    double symbolsPerGroup() const override         //lead-in, two per byte, lead-out
+    {
+        return 2 + 2 * BYTE_BETWEEN_SYNC + 2;
+    }
+
+
+
+    private:
+    bool decodeOversampled(NibbleReader & wire, uint8_t* bytes)        //the lead-in edge is found in the samples themselves, the DPLL keeps the grid centred to the end of the group
+    {
+        const size_t symbol_count = 1 + 2 * BYTE_BETWEEN_SYNC;             //the 0x00 of the lead-in, then the data
+        const size_t per_symbol = recovery->perSymbol();
+        uint8_t samples[(symbol_count + 2) * ClockRecovery::MAX_PER_SYMBOL + 1];
+
+        while(wire.poll() != 0x0F)          //the lead-out of the last group or the lead-in of the next
+        {
+
+        }
+        size_t count = 0;
+        size_t edge = 0;
+        while(edge == 0)                    //a symbol of samples at a time until the falling edge of the lead-in is among them
+        {
+            if(count > 0)
+            {
+                samples[0] = samples[count - 1];
+                count = 1;
+            }
+            wire.oversamples(samples + count, per_symbol, per_symbol);
+            count += per_symbol;
+            for(size_t i = 1; i < count && edge == 0; i++)
+            {
+                edge = samples[i - 1] == 0x0F && samples[i] == 0x00 ? i : 0;
+            }
+        }
+        size_t needed = edge + recovery->samplesFor(symbol_count);
+        wire.oversamples(samples + count, needed - count, per_symbol);
+
+        uint8_t symbols[symbol_count];
+        recovery->decode(samples, needed, edge - 0.5, symbols, symbol_count);          //the edge lies between the last 0x0F and the first 0x00
+        for(uint32_t i = 0; i < BYTE_BETWEEN_SYNC; i++)
+        {
+            bytes[i] = static_cast<uint8_t>((symbols[1 + 2 * i] << 4) | symbols[2 + 2 * i]);
+        }
+        return true;
+    }
+};
+
+
+
+class TransitionCoder : public LineCoder    //9 base-14 digits per 4 bytes, each sent as a step of 1..14 from the last symbol, a marker step every few groups
+{
+    private:
+    static const uint32_t DIGITS = 9;           //14^9 > 2^32
+    static const uint8_t MARKER_STEP = 15;      //a step data never makes, lets a lost receiver find the next group
+    static const uint32_t MARKER_EVERY = 4;     //groups per marker
+    static const uint32_t TIMEOUT_POLLS = 24;   //four symbol periods without a change inside a group and the group is lost
+
+    uint8_t line = 0;                   //last symbol written
+    uint32_t groups = 0;                //groups written, every MARKER_EVERY-th starts with a marker
+    bool hunting = true;                //lost track of the groups, skip symbols until a marker
+    uint8_t previous = 0;               //last symbol read
+
+    public:
+    void encodeGroup(const uint8_t* bytes, std::vector<uint8_t> & nibbles) override
+    {
+        if(groups++ % MARKER_EVERY == 0)
+        {
+            line = (line + MARKER_STEP) & 0x0F;
+            nibbles.push_back(line);
+        }
+
+        uint32_t value = (uint32_t(bytes[0]) << 24) | (bytes[1] << 16) | (bytes[2] << 8) | bytes[3];
+        uint8_t digits[DIGITS];
+        for(uint32_t i = DIGITS; i-- > 0;)
+        {
+            digits[i] = value % 14;
+            value /= 14;
+        }
+        for(uint8_t digit : digits)
+        {
+            line = (line + 1 + digit) & 0x0F;
+            nibbles.push_back(line);
+        }
+    }
+
+
+
+    bool decodeGroup(NibbleReader & wire, uint8_t* bytes) override
+    {
+        if(hunting)
+        {
+            previous = awaitMarker(wire);
+            hunting = false;
+        }
+
+        uint64_t value = 0;
+        bool clean = true;
+        for(uint32_t i = 0; i < DIGITS;)
+        {
+            std::optional<uint8_t> symbol = readSymbol(wire, i == 0 ? 0 : TIMEOUT_POLLS);      //the partner may idle between groups, never inside one
+            if(!symbol)
+            {
+                clean = false;
+                hunting = true;
+                break;
+            }
+            uint8_t step = (*symbol - previous) & 0x0F;
+            previous = *symbol;
+            if(step == MARKER_STEP)
+            {
+                if(i == 0)
+                {
+                    continue;                   //a marker in front of the group, the digits follow
+                }
+                clean = false;                  //we missed a symbol and already ran into the next group, which starts right here
+                break;
+            }
+            value = value * 14 + step - 1;
+            i++;
+        }
+        if(value > 0xFFFFFFFF)
+        {
+            clean = false;
+            hunting = true;
+        }
+        for(uint32_t i = 0; i < BYTE_BETWEEN_SYNC; i++)
+        {
+            bytes[i] = clean ? static_cast<uint8_t>(value >> (24 - 8 * i)) : 0;
+        }
+        return clean;
+    }
+
+
+
+    const char* name() const override
+    {
+        return "transition";
+    }
+
+
+
+    double symbolsPerGroup() const override
+    {
+        return DIGITS + 1.0 / MARKER_EVERY;
+    }
+
+
+
+    private:
+    uint8_t awaitMarker(NibbleReader & wire)        //returns the marker symbol once a marker step went by
+    {
+        uint8_t last = wire.poll();
+        while(true)
+        {
+            uint8_t current = wire.poll();
+            if(current == last)
+            {
+                continue;
+            }
+            current = wire.poll();              //read again once all four lines settled
+            if(((current - last) & 0x0F) == MARKER_STEP)
+            {
+                return current;
+            }
+            last = current;
+        }
+    }
+
+
+
+    std::optional<uint8_t> readSymbol(NibbleReader & wire, uint32_t timeout_polls)      //the next symbol, clocked by its change, 0 waits forever
+    {
+        for(uint32_t i = 0; timeout_polls == 0 || i < timeout_polls; i++)
+        {
+            if(wire.poll() != previous)
+            {
+                return wire.poll();             //read again once all four lines settled
+            }
+        }
+        return std::nullopt;
+    }
+};
+
+
+
+class WideCoder             //bursts on a turned bus: two groups per frame, one byte per symbol on all 8 lines, 12 symbols per 8 bytes
+{
+    public:
+    static constexpr uint32_t FRAME_BYTES = 2 * BYTE_BETWEEN_SYNC;
+
+    private:
+    uint32_t sample_phase;
+
+    public:
+    explicit WideCoder(uint32_t phase = 2)
+        : sample_phase(std::clamp<uint32_t>(phase, 1, 5))
+    {
+
+    }
+
+
+
+    void encodeFrame(const uint8_t* bytes, std::vector<uint8_t> & symbols) const      //appends the symbols for FRAME_BYTES bytes, framing included
+    {
+        symbols.push_back(0xFF);                //lead-in, like the framed coding on all lines
+        symbols.push_back(0x00);
+        symbols.insert(symbols.end(), bytes, bytes + FRAME_BYTES);
+        symbols.push_back(0x00);                //lead-out
+        symbols.push_back(0xFF);
+    }
+
+
+
+    bool decodeFrame(NibbleReader & wire, uint8_t* bytes, uint32_t timeout_polls) const      //false if no lead-in came within timeout_polls
+    {
+        uint8_t previous = 0x00;
+        uint8_t current = wire.poll();
+        for(uint32_t polls = 0; !(previous == 0xFF && current == 0x00); polls++)
+        {
+            if(polls == timeout_polls)
+            {
+                return false;
+            }
+            previous = current;
+            current = wire.poll();
+        }
+        for(uint32_t i = 1; i < sample_phase; i++)
+        {
+            wire.poll();
+        }
+
+        uint8_t symbols[1 + FRAME_BYTES];
+        wire.samples(symbols, sizeof(symbols));     //the 0x00 of the lead-in first
+        std::copy(symbols + 1, symbols + 1 + FRAME_BYTES, bytes);
+        return true;
+    }
+};
+static_assert((HEADER_SIZE + BYTE_PER_PACKAGE) % WideCoder::FRAME_BYTES == 0 && FEC_PARITY % WideCoder::FRAME_BYTES == 0, "a burst has to end with a whole stack");
+
+
+
+inline std::unique_ptr<LineCoder> makeLineCoder(LineCoding coding, uint32_t oversampling = 1, uint32_t sample_phase = 2)     //oversampling and sample_phase only change how a receiver reads, the wire stays the same
+{
+    if(coding == LineCoding::Transition)
+    {
+        return std::make_unique<TransitionCoder>();         //clocks itself on every change already
+    }
+    return std::make_unique<FramedCoder>(oversampling, sample_phase);
+}
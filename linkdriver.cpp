@@ -0,0 +1,758 @@
+#pragma once
+#include "netkitten.cpp"
+#include <stdexcept>
+
+
+
+struct LinkCapabilities
+{
+    bool batch = false;             //driver can move several nibbles in one device transaction
+    bool shared_device = false;     //reads and writes go through the same device handle
+    bool simulated = false;         //no real hardware behind the driver
+    bool coded = false;             //device frames, times and samples whole byte groups itself, see writeGroups()
+    bool turnaround = false;        //driver can switch all 8 lines to one direction, see turnBus()
+};
+
+
+
+enum class BusDirection : uint8_t   //what a driver that can turn its lines around does with them
+{
+    Split,          //4 lines out, 4 in
+    Send,           //all 8 out, the partner listens on all of them
+    Listen,         //all 8 in
+};
+
+
+
+struct StackVerdict                 //a coded device checked the CRC of a stack on its own
+{
+    bool valid;
+    uint32_t checksum;              //checksum field of the stack it checked, tells which stack the verdict is about
+};
+
+
+
+class LinkDriver                    //physical access to the 4 outgoing and 4 incoming lines
+{
+    public:
+    virtual ~LinkDriver() = default;
+
+    virtual void writeNibble(uint8_t half_byte) = 0;            //puts 4 bit onto the outgoing lines
+    virtual uint8_t readNibble() = 0;                           //samples the 4 incoming lines
+    virtual LinkCapabilities capabilities() const = 0;
+    virtual const char* name() const = 0;
+
+
+
+    virtual void writeNibbles(const uint8_t* half_bytes, size_t count, std::chrono::microseconds period)     //writes count nibbles, one per period
+    {
+        auto nextTick = std::chrono::steady_clock::now();
+        for(size_t i = 0; i < count; i++)
+        {
+            writeNibble(half_bytes[i]);
+            nextTick += period;
+            std::this_thread::sleep_until(nextTick);
+        }
+    }
+
+
+
+    virtual void readNibbles(uint8_t* half_bytes, size_t count, std::chrono::microseconds period)          //samples count nibbles, one per period
+    {
+        auto nextTick = std::chrono::steady_clock::now();
+        for(size_t i = 0; i < count; i++)
+        {
+            half_bytes[i] = readNibble();
+            nextTick += period;
+            std::this_thread::sleep_until(nextTick);
+        }
+    }
+
+
+
+    virtual void asyncWriteNibble(uint8_t half_byte, std::function<void()> done)      //done runs once the lines are set, on the LinkScheduler's thread or the one of the port's io_context
+    {
+        writeNibble(half_byte);
+        done();
+    }
+
+
+
+    virtual void asyncReadNibble(std::function<void(uint8_t)> done)       //done gets the sample, on the LinkScheduler's thread or the one of the port's io_context
+    {
+        done(readNibble());
+    }
+
+
+
+    virtual void asyncWriteNibbles(const uint8_t* half_bytes, size_t count, std::chrono::microseconds period, std::function<void()> done)     //batch drivers, done runs once the device took the burst
+    {
+        writeNibbles(half_bytes, count, period);
+        done();
+    }
+
+
+
+    virtual void asyncReadNibbles(uint8_t* half_bytes, size_t count, std::chrono::microseconds period, std::function<void()> done)      //batch drivers, done runs once every sample is in half_bytes
+    {
+        readNibbles(half_bytes, count, period);
+        done();
+    }
+
+
+
+    virtual void writeGroups(const uint8_t* /*bytes*/, size_t /*count*/, std::chrono::microseconds /*period*/)      //coded drivers: queues count groups of BYTE_BETWEEN_SYNC bytes
+    {
+        throw std::logic_error(std::string(name()) + " cannot send whole groups");
+    }
+
+
+
+    virtual bool readGroup(uint8_t* /*bytes*/, std::chrono::microseconds /*period*/)        //coded drivers: waits for the next group the device read, period is what the partner sends with
+    {
+        throw std::logic_error(std::string(name()) + " cannot read whole groups");
+    }
+
+
+
+    virtual std::optional<StackVerdict> takeStackVerdict()      //the device's CRC check of the last stack it saw complete, once
+    {
+        return std::nullopt;
+    }
+
+
+
+    virtual void turnBus(BusDirection /*direction*/)        //turnaround drivers: the partner has to listen on lines before we send on them
+    {
+        throw std::logic_error(std::string(name()) + " cannot turn its lines around");
+    }
+
+
+
+    virtual void writeWide(uint8_t /*symbol*/)              //turnaround drivers: puts 8 bit onto all lines, the partner reads them back as symbol
+    {
+        throw std::logic_error(std::string(name()) + " cannot write on all lines");
+    }
+
+
+
+    virtual uint8_t readWide()                              //turnaround drivers: samples all 8 lines
+    {
+        throw std::logic_error(std::string(name()) + " cannot read all lines");
+    }
+};
+
+
+
+class B15FDriver : public LinkDriver        //low nibble of PORTA is written, high nibble of PINA is read, all of PORTA or PINA once the bus is turned
+{
+    private:
+    B15F & b15f;
+
+    public:
+    explicit B15FDriver(B15F & board)
+        : b15f(board)
+    {
+        b15f.setRegister(&DDRA, 0x0F);
+    }
+
+
+
+    void writeNibble(uint8_t half_byte) override
+    {
+        b15f.setMem8(&PORTA, half_byte);
+    }
+
+
+
+    uint8_t readNibble() override
+    {
+        return b15f.getMem8(&PINA) >> 4;
+    }
+
+
+
+    void turnBus(BusDirection direction) override
+    {
+        static constexpr uint8_t DIRECTIONS[] = {0x0F, 0xFF, 0x00};       //by BusDirection
+        b15f.setRegister(&DDRA, DIRECTIONS[uint8_t(direction)]);
+    }
+
+
+
+    void writeWide(uint8_t symbol) override         //the high nibble goes out on our low lines, they are wired to the partner's high ones
+    {
+        b15f.setMem8(&PORTA, static_cast<uint8_t>((symbol >> 4) | (symbol << 4)));
+    }
+
+
+
+    uint8_t readWide() override
+    {
+        return b15f.getMem8(&PINA);
+    }
+
+
+
+    LinkCapabilities capabilities() const override
+    {
+        LinkCapabilities caps;
+        caps.shared_device = true;
+        caps.turnaround = true;
+        return caps;
+    }
+
+
+
+    const char* name() const override
+    {
+        return "b15f";
+    }
+};
+
+
+
+class ArduinoDriver : public LinkDriver     //talks to ardclient/ardclient.ino, timed bursts if the firmware has them, one 'W' or 'R' command per nibble otherwise
+{
+    private:
+    static constexpr unsigned int BOOT_BAUD = 9600;          //what the firmware starts with
+    static constexpr unsigned int BAUDS[] = {9600, 19200, 38400, 57600, 115200, 230400, 500000, 1000000};     //same order as in the firmware
+
+    boost::asio::io_context & io;
+    boost::asio::serial_port serial;
+    bool batch = false;                 //firmware answered 'V', bursts are timed on the board
+    std::vector<uint8_t> async_command;                 //in flight for asyncWriteNibble/asyncReadNibble
+    uint8_t async_reply = 0;
+
+    public:
+    ArduinoDriver(boost::asio::io_context & context, const std::string & device, unsigned int baud)       //baud is what we try to move up to
+        : io(context), serial(context)
+    {
+        serial.open(device);
+        setBaud(BOOT_BAUD);
+        serial.set_option(boost::asio::serial_port_base::character_size(8));
+        serial.set_option(boost::asio::serial_port_base::parity(boost::asio::serial_port_base::parity::none));
+        serial.set_option(boost::asio::serial_port_base::stop_bits(boost::asio::serial_port_base::stop_bits::one));
+        serial.set_option(boost::asio::serial_port_base::flow_control(boost::asio::serial_port_base::flow_control::none));
+        std::this_thread::sleep_for(std::chrono::milliseconds(2000));      //the board resets when the port is opened
+
+        uint8_t version[2];
+        send({'V'});
+        batch = readFor(version, 2, std::chrono::milliseconds(500)) && version[0] == 'V' && version[1] >= 2;
+        if(!batch)
+        {
+            std::cerr << "arduino firmware has no timed bursts, using single nibble commands at " << BOOT_BAUD << " baud" << std::endl;
+            return;
+        }
+        negotiateBaud(baud);
+    }
+
+
+
+    void writeNibble(uint8_t half_byte) override
+    {
+        send({'W', half_byte});
+    }
+
+
+
+    uint8_t readNibble() override
+    {
+        uint8_t incoming = 0;
+        send({'R'});
+        boost::system::error_code error;
+        boost::asio::read(serial, boost::asio::buffer(&incoming, 1), error);
+        return incoming;
+    }
+
+
+
+    void asyncWriteNibble(uint8_t half_byte, std::function<void()> done) override       //the LinkScheduler runs one access at a time, so the buffers can be members
+    {
+        async_command = {'W', half_byte};
+        boost::asio::async_write(serial, boost::asio::buffer(async_command), [done = std::move(done)](const boost::system::error_code &, size_t) { done(); });
+    }
+
+
+
+    void asyncReadNibble(std::function<void(uint8_t)> done) override
+    {
+        async_command = {'R'};
+        boost::asio::async_write(serial, boost::asio::buffer(async_command), [this, done = std::move(done)](const boost::system::error_code & error, size_t) mutable
+        {
+            if(error)
+            {
+                done(0);
+                return;
+            }
+            boost::asio::async_read(serial, boost::asio::buffer(&async_reply, 1), [this, done = std::move(done)](const boost::system::error_code &, size_t) { done(async_reply); });
+        });
+    }
+
+
+
+    void writeNibbles(const uint8_t* half_bytes, size_t count, std::chrono::microseconds period) override      //returns once the burst is queued on the board
+    {
+        if(!batch)
+        {
+            LinkDriver::writeNibbles(half_bytes, count, period);
+            return;
+        }
+        send(burstCommands(half_bytes, count, period));
+    }
+
+
+
+    void readNibbles(uint8_t* half_bytes, size_t count, std::chrono::microseconds period) override     //samples arrive while the board takes them
+    {
+        if(!batch)
+        {
+            LinkDriver::readNibbles(half_bytes, count, period);
+            return;
+        }
+        for(size_t done = 0; done < count; done += 255)
+        {
+            size_t part = std::min<size_t>(255, count - done);
+            std::vector<uint8_t> command = {'S'};
+            appendPeriod(command, period);
+            command.push_back(static_cast<uint8_t>(part));
+            send(command);
+            boost::system::error_code error;
+            boost::asio::read(serial, boost::asio::buffer(half_bytes + done, part), error);
+        }
+    }
+
+
+
+    void asyncWriteNibbles(const uint8_t* half_bytes, size_t count, std::chrono::microseconds period, std::function<void()> done) override
+    {
+        if(!batch)
+        {
+            LinkDriver::asyncWriteNibbles(half_bytes, count, period, std::move(done));
+            return;
+        }
+        async_command = burstCommands(half_bytes, count, period);
+        boost::asio::async_write(serial, boost::asio::buffer(async_command), [done = std::move(done)](const boost::system::error_code &, size_t) { done(); });
+    }
+
+
+
+    void asyncReadNibbles(uint8_t* half_bytes, size_t count, std::chrono::microseconds period, std::function<void()> done) override      //one 'S' run of up to 255 samples after the other
+    {
+        if(!batch || count == 0)
+        {
+            LinkDriver::asyncReadNibbles(half_bytes, count, period, std::move(done));
+            return;
+        }
+        size_t part = std::min<size_t>(255, count);
+        async_command = {'S'};
+        appendPeriod(async_command, period);
+        async_command.push_back(static_cast<uint8_t>(part));
+        boost::asio::async_write(serial, boost::asio::buffer(async_command), [this, half_bytes, count, part, period, done = std::move(done)](const boost::system::error_code &, size_t) mutable
+        {
+            boost::asio::async_read(serial, boost::asio::buffer(half_bytes, part), [this, half_bytes, count, part, period, done = std::move(done)](const boost::system::error_code &, size_t) mutable
+            {
+                asyncReadNibbles(half_bytes + part, count - part, period, std::move(done));
+            });
+        });
+    }
+
+
+
+    LinkCapabilities capabilities() const override
+    {
+        LinkCapabilities caps;
+        caps.batch = batch;
+        caps.shared_device = true;
+        return caps;
+    }
+
+
+
+    const char* name() const override
+    {
+        return "arduino";
+    }
+
+
+
+    private:
+    void negotiateBaud(unsigned int baud)       //'U' switches the board, a 'P' at the new rate confirms it, otherwise both end up at BOOT_BAUD again
+    {
+        const unsigned int* found = std::find(std::begin(BAUDS), std::end(BAUDS), baud);
+        if(baud == BOOT_BAUD || found == std::end(BAUDS))
+        {
+            return;
+        }
+
+        uint8_t reply = 0;
+        send({'U', static_cast<uint8_t>(found - std::begin(BAUDS))});
+        if(!readFor(&reply, 1, std::chrono::milliseconds(500)) || reply != 'U')
+        {
+            std::cerr << "arduino refused " << baud << " baud" << std::endl;
+            return;
+        }
+        setBaud(baud);
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        send({'P'});
+        if(readFor(&reply, 1, std::chrono::milliseconds(500)) && reply == 'P')
+        {
+            return;
+        }
+
+        std::cerr << "arduino did not answer at " << baud << " baud, staying at " << BOOT_BAUD << std::endl;
+        setBaud(BOOT_BAUD);
+        std::this_thread::sleep_for(std::chrono::milliseconds(1200));      //the board falls back after a second without a ping
+    }
+
+
+
+    void setBaud(unsigned int baud)
+    {
+        serial.set_option(boost::asio::serial_port_base::baud_rate(baud));
+    }
+
+
+
+    void send(const std::vector<uint8_t> & command)
+    {
+        boost::asio::write(serial, boost::asio::buffer(command));
+    }
+
+
+
+    static void appendPeriod(std::vector<uint8_t> & command, std::chrono::microseconds period)     //4 byte big endian microseconds
+    {
+        uint32_t value = static_cast<uint32_t>(period.count());
+        for(int shift = 24; shift >= 0; shift -= 8)
+        {
+            command.push_back(static_cast<uint8_t>(value >> shift));
+        }
+    }
+
+
+
+    static std::vector<uint8_t> burstCommands(const uint8_t* half_bytes, size_t count, std::chrono::microseconds period)       //'T' commands of up to 254 nibbles
+    {
+        std::vector<uint8_t> commands;
+        for(size_t done = 0; done < count; done += 254)
+        {
+            size_t part = std::min<size_t>(254, count - done);
+            commands.push_back('T');
+            appendPeriod(commands, period);
+            commands.push_back(static_cast<uint8_t>(part));
+            for(size_t i = 0; i < part; i += 2)         //two nibbles per byte, high one first
+            {
+                uint8_t high = half_bytes[done + i] & 0x0F;
+                uint8_t low = i + 1 < part ? half_bytes[done + i + 1] & 0x0F : 0;
+                commands.push_back(static_cast<uint8_t>((high << 4) | low));
+            }
+        }
+        return commands;
+    }
+
+
+
+    bool readFor(uint8_t* data, size_t count, std::chrono::milliseconds timeout)      //false if the board did not answer in time
+    {
+        bool done = false;
+        boost::system::error_code result;
+        boost::asio::async_read(serial, boost::asio::buffer(data, count), [&](const boost::system::error_code & error, size_t) { done = true; result = error; });
+        io.restart();
+        io.run_for(timeout);
+        if(!done)
+        {
+            serial.cancel();
+            io.restart();
+            io.run();               //let the cancelled read finish before data goes out of scope
+        }
+        return done && !result;
+    }
+};
+
+
+
+class PhyDriver : public LinkDriver         //talks to ardphy/ardphy.ino, the board frames, times and samples groups on a timer interrupt and checks stack CRCs
+{
+    private:
+    static constexpr unsigned int BAUD = 500000;            //fixed in the firmware
+
+    boost::asio::io_context & io;
+    boost::asio::serial_port serial;
+    std::mutex write_lock;              //the transmitter and the receiver both send commands, only the receiver reads
+    std::chrono::microseconds tx_period{0};         //last period told to the board, 0 before the first
+    std::chrono::microseconds rx_period{0};
+    std::mutex verdict_lock;
+    std::optional<StackVerdict> verdict;
+
+    public:
+    PhyDriver(boost::asio::io_context & context, const std::string & device)
+        : io(context), serial(context)
+    {
+        serial.open(device);
+        serial.set_option(boost::asio::serial_port_base::baud_rate(BAUD));
+        serial.set_option(boost::asio::serial_port_base::character_size(8));
+        serial.set_option(boost::asio::serial_port_base::parity(boost::asio::serial_port_base::parity::none));
+        serial.set_option(boost::asio::serial_port_base::stop_bits(boost::asio::serial_port_base::stop_bits::one));
+        serial.set_option(boost::asio::serial_port_base::flow_control(boost::asio::serial_port_base::flow_control::none));
+        std::this_thread::sleep_for(std::chrono::milliseconds(2000));      //the board resets when the port is opened
+
+        uint8_t version[2];
+        send({'F'});
+        if(!readFor(version, 2, std::chrono::milliseconds(500)) || version[0] != 'F')
+        {
+            throw std::runtime_error("no ardphy firmware on " + device);
+        }
+    }
+
+
+
+    void writeNibble(uint8_t half_byte) override        //bypasses the queue, only good for idling the lines
+    {
+        send({'W', half_byte});
+    }
+
+
+
+    uint8_t readNibble() override
+    {
+        throw std::logic_error("phy only reads whole groups");
+    }
+
+
+
+    void writeGroups(const uint8_t* bytes, size_t count, std::chrono::microseconds period) override       //returns once the groups are queued on the board
+    {
+        for(size_t done = 0; done < count; done += 255)
+        {
+            size_t part = std::min<size_t>(255, count - done);
+            std::vector<uint8_t> command;
+            if(period != tx_period)
+            {
+                command.push_back('X');
+                appendPeriod(command, period);
+                tx_period = period;
+            }
+            command.push_back('G');
+            command.push_back(static_cast<uint8_t>(part));
+            command.insert(command.end(), bytes + done * BYTE_BETWEEN_SYNC, bytes + (done + part) * BYTE_BETWEEN_SYNC);
+            send(command);
+        }
+    }
+
+
+
+    bool readGroup(uint8_t* bytes, std::chrono::microseconds period) override
+    {
+        if(period != rx_period)
+        {
+            std::vector<uint8_t> command = {'Y'};
+            appendPeriod(command, period);
+            send(command);
+            rx_period = period;
+        }
+
+        while(true)
+        {
+            uint8_t kind = 0;
+            boost::system::error_code error;
+            boost::asio::read(serial, boost::asio::buffer(&kind, 1), error);
+            if(error)
+            {
+                return false;
+            }
+            if(kind == 'g')
+            {
+                boost::asio::read(serial, boost::asio::buffer(bytes, BYTE_BETWEEN_SYNC), error);
+                return !error;
+            }
+            if(kind == 'c')         //verdict for the stack the next group completes
+            {
+                uint8_t report[5];
+                boost::asio::read(serial, boost::asio::buffer(report, sizeof(report)), error);
+                std::lock_guard<std::mutex> guard(verdict_lock);
+                verdict = StackVerdict{report[0] == 1, (uint32_t(report[1]) << 24) | (report[2] << 16) | (report[3] << 8) | report[4]};
+            }
+            //anything else is noise from before the board was up, skip it
+        }
+    }
+
+
+
+    std::optional<StackVerdict> takeStackVerdict() override
+    {
+        std::lock_guard<std::mutex> guard(verdict_lock);
+        return std::exchange(verdict, std::nullopt);
+    }
+
+
+
+    LinkCapabilities capabilities() const override
+    {
+        LinkCapabilities caps;
+        caps.coded = true;
+        return caps;
+    }
+
+
+
+    const char* name() const override
+    {
+        return "phy";
+    }
+
+
+
+    private:
+    void send(const std::vector<uint8_t> & command)
+    {
+        std::lock_guard<std::mutex> guard(write_lock);
+        boost::asio::write(serial, boost::asio::buffer(command));
+    }
+
+
+
+    static void appendPeriod(std::vector<uint8_t> & command, std::chrono::microseconds period)     //4 byte big endian microseconds
+    {
+        uint32_t value = static_cast<uint32_t>(period.count());
+        for(int shift = 24; shift >= 0; shift -= 8)
+        {
+            command.push_back(static_cast<uint8_t>(value >> shift));
+        }
+    }
+
+
+
+    bool readFor(uint8_t* data, size_t count, std::chrono::milliseconds timeout)      //false if the board did not answer in time
+    {
+        bool done = false;
+        boost::system::error_code result;
+        boost::asio::async_read(serial, boost::asio::buffer(data, count), [&](const boost::system::error_code & error, size_t) { done = true; result = error; });
+        io.restart();
+        io.run_for(timeout);
+        if(!done)
+        {
+            serial.cancel();
+            io.restart();
+            io.run();
+        }
+        return done && !result;
+    }
+};
+
+
+
+class LoopbackWire          //two sets of 4 lines crossing over between side 0 and side 1
+{
+    public:
+    std::atomic<uint8_t> lanes[2] = {{0}, {0}};     //lanes[i] is written by side i, and by the other side while it sends on all lines
+    std::atomic<BusDirection> directions[2] = {{BusDirection::Split}, {BusDirection::Split}};
+    std::atomic<uint64_t> clashes{0};               //writes onto a lane the other side was driving as well
+    double error_rate = 0;                          //chance of one flipped line per written nibble
+    std::atomic<bool> cut{false};                   //the cable was pulled, the lanes keep what was on them last
+    std::mutex noise_lock;
+    std::mt19937 noise{12345};
+
+
+
+    uint8_t disturb(uint8_t half_byte)
+    {
+        if(error_rate <= 0)
+        {
+            return half_byte;
+        }
+        std::lock_guard<std::mutex> guard(noise_lock);
+        if(std::uniform_real_distribution<double>(0, 1)(noise) < error_rate)
+        {
+            half_byte ^= 1 << std::uniform_int_distribution<int>(0, 3)(noise);
+        }
+        return half_byte;
+    }
+};
+
+
+
+class LoopbackDriver : public LinkDriver        //one end of a LoopbackWire, lets two peers run inside one process
+{
+    private:
+    LoopbackWire & wire;
+    int side;
+    std::atomic<uint8_t> & out_lane;
+    std::atomic<uint8_t> & in_lane;
+
+    public:
+    LoopbackDriver(LoopbackWire & w, int s)
+        : wire(w), side(s & 1), out_lane(w.lanes[side]), in_lane(w.lanes[side ^ 1])
+    {
+
+    }
+
+
+
+    void writeNibble(uint8_t half_byte) override
+    {
+        if(wire.cut.load())
+        {
+            return;
+        }
+        if(wire.directions[side ^ 1].load() == BusDirection::Send)
+        {
+            wire.clashes++;
+        }
+        out_lane.store(wire.disturb(half_byte & 0x0F));
+    }
+
+
+
+    uint8_t readNibble() override
+    {
+        return in_lane.load();
+    }
+
+
+
+    void turnBus(BusDirection direction) override
+    {
+        wire.directions[side].store(direction);
+    }
+
+
+
+    void writeWide(uint8_t symbol) override         //same wiring as two B15F boards: our lane carries the high nibble
+    {
+        if(wire.cut.load())
+        {
+            return;
+        }
+        if(wire.directions[side ^ 1].load() != BusDirection::Listen)
+        {
+            wire.clashes++;
+        }
+        out_lane.store(wire.disturb(symbol >> 4));
+        in_lane.store(wire.disturb(symbol & 0x0F));
+    }
+
+
+
+    uint8_t readWide() override
+    {
+        return static_cast<uint8_t>((in_lane.load() << 4) | out_lane.load());
+    }
+
+
+
+    LinkCapabilities capabilities() const override
+    {
+        LinkCapabilities caps;
+        caps.simulated = true;
+        caps.turnaround = true;
+        return caps;
+    }
+
+
+
+    const char* name() const override
+    {
+        return "loopback";
+    }
+};
@@ -0,0 +1,392 @@
+#pragma once
+#include "netkitten.cpp"
+#include "linkdriver.cpp"
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <cmath>
+
+
+
+class LinkEngine            //runs one io_context on its own thread: the drivers' serial ports complete on it, every LinkScheduler times its slots on a thread of its own
+{
+    private:
+    boost::asio::io_context & io;
+    boost::asio::executor_work_guard<boost::asio::io_context::executor_type> work;
+    std::thread runner;
+
+    public:
+    explicit LinkEngine(boost::asio::io_context & context)      //start it once drivers are done using context for their setup
+        : io(context), work(boost::asio::make_work_guard(context)), runner([this] { io.run(); })
+    {
+
+    }
+
+    ~LinkEngine()
+    {
+        work.reset();
+        io.stop();
+        runner.join();
+    }
+
+    LinkEngine(const LinkEngine &) = delete;
+    LinkEngine & operator=(const LinkEngine &) = delete;
+
+
+
+    boost::asio::io_context & context()
+    {
+        return io;
+    }
+};
+
+
+
+struct SlotJitter           //how late slots started compared to their grid tick
+{
+    uint64_t slots = 0;
+    double mean_us = 0;
+    double deviation_us = 0;            //standard deviation
+    double max_us = 0;
+};
+
+
+
+class LinkScheduler         //the only thing that touches its device: transmit and receive requests queue up and are carried out on a fixed time grid, on a thread of its own so a device call that blocks holds up no other link
+{
+    private:
+    enum class Op : uint8_t
+    {
+        Write, Read, WriteNibbles, ReadNibbles, WriteGroups, WriteWide, ReadWide, TurnBus
+    };
+
+    enum class SlotState : uint8_t
+    {
+        Free, Queued, Running, Done
+    };
+
+    struct Request                      //one blocked caller, everything the device access needs is in here so nothing is allocated per nibble
+    {
+        SlotState state = SlotState::Free;
+        Op op = Op::Write;
+        bool transmit = false;
+        uint64_t order = 0;             //submission count, same due requests of a kind go first come first served
+        std::chrono::steady_clock::time_point due;
+        uint8_t value = 0;              //nibble or symbol to write, the sample read
+        const uint8_t* out = nullptr;
+        uint8_t* in = nullptr;
+        size_t count = 0;
+        std::chrono::microseconds period{0};
+        BusDirection direction = BusDirection::Split;
+        std::exception_ptr failure;     //a driver that throws fails the caller, not the scheduler's thread
+    };
+
+    static constexpr size_t SLOTS = 4;  //every caller blocks on its one request: a transmitter, a receiver, room for a calibrator
+
+    struct Tally                        //running sums for SlotJitter
+    {
+        uint64_t slots = 0;
+        double sum = 0;
+        double squares = 0;
+        double max = 0;
+    };
+
+    LinkDriver & link;
+    const std::chrono::microseconds grid;
+    const std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+    std::mutex lock;                    //guards the slots and the flags below
+    std::condition_variable wake;       //runner: a request came in, the device is free again or it has to stop
+    std::condition_variable finished;   //callers: a request is done or a slot is free again
+    std::array<Request, SLOTS> slots;
+    uint64_t submitted = 0;
+    bool accessing = false;             //the device is busy with a request
+    bool stopping = false;
+    mutable std::mutex tally_lock;
+    Tally tallies[2];                   //transmit, receive
+    std::thread runner;                 //last, it starts once everything it uses is there
+
+    public:
+    LinkScheduler(LinkDriver & drv, const LinkOptions & options)
+        : link(drv), grid(std::max<uint32_t>(1, options.slot_grid_us)), runner([this] { run(); })
+    {
+
+    }
+
+    ~LinkScheduler()
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_one();
+        runner.join();
+    }
+
+    LinkScheduler(const LinkScheduler &) = delete;
+    LinkScheduler & operator=(const LinkScheduler &) = delete;
+
+
+
+    void write(uint8_t half_byte, std::chrono::steady_clock::time_point slot)      //puts half_byte on the lines at slot, returns once it is there
+    {
+        Request request;
+        request.op = Op::Write;
+        request.value = half_byte;
+        submit(true, slot, request);
+    }
+
+
+
+    uint8_t read(std::chrono::steady_clock::time_point slot)       //samples the lines at slot
+    {
+        Request request;
+        request.op = Op::Read;
+        return submit(false, slot, request);
+    }
+
+
+
+    void writeNibbles(const uint8_t* half_bytes, size_t count, std::chrono::microseconds period)      //a burst the device times itself, returns once it took it
+    {
+        Request request;
+        request.op = Op::WriteNibbles;
+        request.out = half_bytes;
+        request.count = count;
+        request.period = period;
+        submit(true, std::chrono::steady_clock::now(), request);
+    }
+
+
+
+    void readNibbles(uint8_t* half_bytes, size_t count, std::chrono::microseconds period, std::chrono::steady_clock::time_point slot)     //count samples from slot on, timed by the device
+    {
+        Request request;
+        request.op = Op::ReadNibbles;
+        request.in = half_bytes;
+        request.count = count;
+        request.period = period;
+        submit(false, slot, request);
+    }
+
+
+
+    void writeGroups(const uint8_t* bytes, size_t count, std::chrono::microseconds period)        //coded devices, see LinkDriver::writeGroups
+    {
+        Request request;
+        request.op = Op::WriteGroups;
+        request.out = bytes;
+        request.count = count;
+        request.period = period;
+        submit(true, std::chrono::steady_clock::now(), request);
+    }
+
+
+
+    void writeWide(uint8_t symbol, std::chrono::steady_clock::time_point slot)        //turned bus, see LinkDriver::writeWide
+    {
+        Request request;
+        request.op = Op::WriteWide;
+        request.value = symbol;
+        submit(true, slot, request);
+    }
+
+
+
+    uint8_t readWide(std::chrono::steady_clock::time_point slot)
+    {
+        Request request;
+        request.op = Op::ReadWide;
+        return submit(false, slot, request);
+    }
+
+
+
+    void turnBus(BusDirection direction)            //right away, returns once the lines changed direction
+    {
+        Request request;
+        request.op = Op::TurnBus;
+        request.direction = direction;
+        submit(true, std::chrono::steady_clock::now(), request);
+    }
+
+
+
+    SlotJitter jitter(bool transmit) const
+    {
+        std::lock_guard<std::mutex> guard(tally_lock);
+        const Tally & tally = tallies[transmit ? 0 : 1];
+        SlotJitter result;
+        result.slots = tally.slots;
+        if(tally.slots > 0)
+        {
+            result.mean_us = tally.sum / tally.slots;
+            result.deviation_us = std::sqrt(std::max(0.0, tally.squares / tally.slots - result.mean_us * result.mean_us));
+            result.max_us = tally.max;
+        }
+        return result;
+    }
+
+
+
+    private:
+    uint8_t submit(bool transmit, std::chrono::steady_clock::time_point due, const Request & request)      //queues request in a free slot and blocks until the runner carried it out, returns the sample of a read
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        Request * slot = nullptr;
+        finished.wait(guard, [&]
+        {
+            for(Request & candidate : slots)
+            {
+                if(candidate.state == SlotState::Free)
+                {
+                    slot = &candidate;
+                    return true;
+                }
+            }
+            return false;
+        });
+        *slot = request;
+        slot->state = SlotState::Queued;
+        slot->transmit = transmit;
+        slot->due = due;
+        slot->order = submitted++;
+        wake.notify_one();              //it may be due before what the runner waits for
+        finished.wait(guard, [slot] { return slot->state == SlotState::Done; });
+        uint8_t value = slot->value;
+        std::exception_ptr failure = slot->failure;
+        slot->state = SlotState::Free;
+        guard.unlock();
+        finished.notify_all();          //a caller may wait for the slot
+        if(failure)
+        {
+            std::rethrow_exception(failure);
+        }
+        return value;
+    }
+
+
+
+    Request * earliest()        //the earlier request goes first, transmits on a tie
+    {
+        Request * first = nullptr;
+        for(Request & candidate : slots)
+        {
+            if(candidate.state != SlotState::Queued)
+            {
+                continue;
+            }
+            if(!first || candidate.due < first->due || (candidate.due == first->due && (candidate.transmit > first->transmit || (candidate.transmit == first->transmit && candidate.order < first->order))))
+            {
+                first = &candidate;
+            }
+        }
+        return first;
+    }
+
+
+
+    void run()          //waits for the grid tick of the earliest request, one access at a time
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        while(!stopping)
+        {
+            Request * next = accessing ? nullptr : earliest();
+            if(!next)
+            {
+                wake.wait(guard);
+                continue;
+            }
+            auto tick = gridTick(next->due);
+            if(std::chrono::steady_clock::now() < tick)
+            {
+                wake.wait_until(guard, tick);       //a request due earlier wakes it up before
+                continue;
+            }
+            next->state = SlotState::Running;
+            accessing = true;
+            guard.unlock();
+            record(next->transmit, std::chrono::steady_clock::now() - tick);
+            access(*next);
+            guard.lock();
+        }
+    }
+
+
+
+    void access(Request & request)          //the device calls complete once it is done, right away or from the engine that owns its port
+    {
+        try
+        {
+            switch(request.op)
+            {
+            case Op::Write:
+                link.asyncWriteNibble(request.value, [this, &request] { complete(request); });
+                break;
+            case Op::Read:
+                link.asyncReadNibble([this, &request](uint8_t half_byte) { request.value = half_byte & 0x0F; complete(request); });
+                break;
+            case Op::WriteNibbles:
+                link.asyncWriteNibbles(request.out, request.count, request.period, [this, &request] { complete(request); });
+                break;
+            case Op::ReadNibbles:
+                link.asyncReadNibbles(request.in, request.count, request.period, [this, &request] { complete(request); });
+                break;
+            case Op::WriteGroups:
+                link.writeGroups(request.out, request.count, request.period);
+                complete(request);
+                break;
+            case Op::WriteWide:
+                link.writeWide(request.value);
+                complete(request);
+                break;
+            case Op::ReadWide:
+                request.value = link.readWide();
+                complete(request);
+                break;
+            case Op::TurnBus:
+                link.turnBus(request.direction);
+                complete(request);
+                break;
+            }
+        }
+        catch(...)
+        {
+            request.failure = std::current_exception();
+            complete(request);
+        }
+    }
+
+
+
+    void complete(Request & request)        //the captures of the device callbacks are two pointers, std::function keeps them without allocating
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            request.state = SlotState::Done;
+            accessing = false;
+        }
+        finished.notify_all();
+        wake.notify_one();
+    }
+
+
+
+    std::chrono::steady_clock::time_point gridTick(std::chrono::steady_clock::time_point due) const       //first tick at or after due
+    {
+        auto ticks = (due - origin + grid - std::chrono::nanoseconds(1)) / grid;
+        return origin + std::max<decltype(ticks)>(0, ticks) * grid;
+    }
+
+
+
+    void record(bool transmit, std::chrono::steady_clock::duration late)
+    {
+        double us = std::chrono::duration<double, std::micro>(late).count();
+        std::lock_guard<std::mutex> guard(tally_lock);
+        Tally & tally = tallies[transmit ? 0 : 1];
+        tally.slots++;
+        tally.sum += us;
+        tally.squares += us * us;
+        tally.max = std::max(tally.max, us);
+    }
+};
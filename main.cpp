@@ -1,31 +1,388 @@
 #include "transmitter.cpp"
 #include "receiver.cpp"
+#include "benchmark.cpp"
+#include "calibration.cpp"
 #include <cstring> // For strcmp
+#include <memory>
+#include <sstream>
+
+
+
+struct Peer         //one side of a link: the shared state plus its Receiver and Transmitter
+{
+    Channel<AckReport> ack_reports;
+    UniqueChannel<uint32_t> ack_queue;
+    UniqueChannel<uint32_t> neg_ack_queue;
+    UniqueChannel<uint32_t> resend_queue;
+    std::atomic<bool> established{false};
+    std::atomic<bool> listening{false};
+    std::atomic<bool> partner_finished{false};
+    LinkScheduler scheduler;
+    LinkState state;
+    Receiver receiver;
+    Transmitter transmitter;
+
+    Peer(LinkDriver & link, std::istream & in, std::ostream & out, const LinkOptions & options, Bond * bond = nullptr, uint32_t index = 0)
+        : scheduler(link, options),
+          state(options),
+          receiver(link, out, ack_reports, ack_queue, neg_ack_queue, resend_queue, established, listening, bond ? bond->partner_finished : partner_finished, scheduler, state, options, bond),
+          transmitter(link, in, ack_reports, ack_queue, neg_ack_queue, resend_queue, established, listening, bond ? bond->partner_finished : partner_finished, scheduler, state, options, bond, index)
+    {
+
+    }
+
+
+
+    Peer(LinkDriver & link, Bond & bond, uint32_t index, const LinkOptions & options)      //link index of a bonded transfer, the bond reads and writes the streams
+        : Peer(link, bond.no_input, bond.no_output, options, &bond, index)
+    {
+
+    }
+};
+
+
+
+std::vector<std::unique_ptr<Peer>> bondLinks(const std::vector<std::unique_ptr<LinkDriver>> & links, Bond & bond, const LinkOptions & options)
+{
+    std::vector<std::unique_ptr<Peer>> peers;
+    for(uint32_t i = 0; i < links.size(); i++)
+    {
+        peers.push_back(std::make_unique<Peer>(*links[i], bond, i, options));
+    }
+    return peers;
+}
+
+
+
+std::vector<std::thread> startBonded(std::vector<std::unique_ptr<Peer>> & peers, Bond & bond, std::istream & in, std::chrono::milliseconds head_start)      //the bond's reader and every link's Transmitter to join, the Receivers are detached and stay blocked on their lines
+{
+    std::vector<std::thread> threads;
+    threads.emplace_back(&BondSender::readInput, &bond.sender, std::ref(in));
+    for(auto & peer : peers)
+    {
+        std::thread(&Receiver::beginListening, &peer->receiver).detach();
+    }
+    std::this_thread::sleep_for(head_start);
+    for(auto & peer : peers)
+    {
+        threads.emplace_back(&Transmitter::beginTransmission, &peer->transmitter);
+    }
+    return threads;
+}
+
+
+
+void reportBonded(const std::vector<std::unique_ptr<Peer>> & peers)      //how the transfer was striped, to stderr
+{
+    for(uint32_t i = 0; i < peers.size(); i++)
+    {
+        std::cerr << "link " << i << ": " << peers[i]->transmitter.packagesOpened() << " packages" << std::endl;
+    }
+}
+
+
+
+void reportJitter(const char* side, const LinkScheduler & scheduler)       //how late the scheduler carried out slots, to stderr
+{
+    for(bool transmit : {true, false})
+    {
+        SlotJitter jitter = scheduler.jitter(transmit);
+        std::cerr << side << (transmit ? " transmit" : " receive") << " slots: " << jitter.slots
+                  << ", late by " << jitter.mean_us << " us mean, " << jitter.deviation_us << " us deviation, " << jitter.max_us << " us max" << std::endl;
+    }
+}
+
+
+
+int runLoopback(const LinkOptions & options, double error_rate)       //sends cin from side 0 to side 1 over an in-process wire, side 1 writes it to cout
+{
+    LoopbackWire wire;
+    wire.error_rate = error_rate;
+    LoopbackDriver link_a(wire, 0);
+    LoopbackDriver link_b(wire, 1);
+    std::istringstream nothing;
+    std::ostream discard(nullptr);
+
+    Peer a(link_a, std::cin, discard, options);
+    Peer b(link_b, nothing, std::cout, options);
+
+    auto begin = std::chrono::steady_clock::now();
+    std::thread receiver_a(&Receiver::beginListening, &a.receiver);
+    std::thread receiver_b(&Receiver::beginListening, &b.receiver);
+    std::thread transmitter_a(&Transmitter::beginTransmission, &a.transmitter);
+    std::thread transmitter_b(&Transmitter::beginTransmission, &b.transmitter);
+    transmitter_a.join();
+    transmitter_b.join();
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - begin);
+    std::cerr << "loopback transfer took " << elapsed.count() << " ms" << std::endl;
+    reportJitter("side 0", a.scheduler);
+    reportJitter("side 1", b.scheduler);
+    if(options.wide_bus)
+    {
+        std::cerr << "bus clashes: " << wire.clashes.load() << std::endl;
+    }
+
+    receiver_a.detach();
+    receiver_b.detach();
+    std::_Exit(a.state.aborted.load() || b.state.aborted.load() ? 1 : 0);          //receivers are still blocked on the wire, do not wait for them
+}
+
+
+
+int runBondedLoopback(const LinkOptions & options, double error_rate, uint32_t link_count, uint32_t cut_ms)       //cin from side 0 striped over link_count in-process wires, side 1 writes it to cout; wire 0 is pulled after cut_ms if that is not 0
+{
+    std::vector<std::unique_ptr<LoopbackWire>> wires;
+    std::vector<std::unique_ptr<LinkDriver>> links_a;
+    std::vector<std::unique_ptr<LinkDriver>> links_b;
+    for(uint32_t i = 0; i < link_count; i++)
+    {
+        wires.push_back(std::make_unique<LoopbackWire>());
+        wires.back()->error_rate = error_rate;
+        links_a.push_back(std::make_unique<LoopbackDriver>(*wires.back(), 0));
+        links_b.push_back(std::make_unique<LoopbackDriver>(*wires.back(), 1));
+    }
+    std::istringstream nothing;
+    std::ostream discard(nullptr);
+    Bond a(discard, options);
+    Bond b(std::cout, options);
+    std::vector<std::unique_ptr<Peer>> peers_a = bondLinks(links_a, a, options);
+    std::vector<std::unique_ptr<Peer>> peers_b = bondLinks(links_b, b, options);
+
+    auto begin = std::chrono::steady_clock::now();
+    if(cut_ms > 0)
+    {
+        std::thread([&wire = *wires.front(), cut_ms]
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(cut_ms));
+            wire.cut.store(true);
+        }).detach();
+    }
+    std::vector<std::thread> threads_a = startBonded(peers_a, a, std::cin, std::chrono::milliseconds(0));
+    std::vector<std::thread> threads_b = startBonded(peers_b, b, nothing, std::chrono::milliseconds(0));
+    for(std::thread & thread : threads_a)
+    {
+        thread.join();
+    }
+    for(std::thread & thread : threads_b)
+    {
+        thread.join();
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - begin);
+    std::cerr << "bonded loopback transfer took " << elapsed.count() << " ms" << std::endl;
+    reportBonded(peers_a);
+    std::_Exit(0);          //receivers are still blocked on the wires, do not wait for them
+}
+
+
+
+int runBonded(std::vector<std::unique_ptr<LinkDriver>> & links, boost::asio::io_context & io, const LinkOptions & options)      //-bond: one transfer striped over every link given with -links, the partner bonds the same cables
+{
+    LinkEngine engine(io);              //the serial ports of all links, each link's slots run on its scheduler's own thread
+    Bond bond(std::cout, options);
+    std::vector<std::unique_ptr<Peer>> peers = bondLinks(links, bond, options);
+    std::vector<std::thread> threads = startBonded(peers, bond, std::cin, std::chrono::milliseconds(1000));
+    for(std::thread & thread : threads)
+    {
+        thread.join();
+    }
+    reportBonded(peers);
+    for(uint32_t i = 0; i < peers.size(); i++)
+    {
+        reportJitter(("link " + std::to_string(i)).c_str(), peers[i]->scheduler);
+    }
+    std::cout.flush();
+    std::_Exit(0);          //a dead link's receiver is still blocked on its lines
+}
+
+
+
+std::unique_ptr<LinkDriver> openLink(const std::string & spec, boost::asio::io_context & io, unsigned int baud, LinkOptions & options)      //one entry of -links: b15f, ard:<device> or phy:<device>
+{
+    if(spec == "b15f")
+    {
+        return std::make_unique<B15FDriver>(B15F::getInstance());
+    }
+    if(spec.rfind("ard:", 0) == 0)
+    {
+        return std::make_unique<ArduinoDriver>(io, spec.substr(4), baud);
+    }
+    if(spec.rfind("phy:", 0) == 0)
+    {
+        if(options.line_coding != LineCoding::Framed)
+        {
+            std::cerr << "ardphy only speaks the framed coding, using it on every link" << std::endl;
+            options.line_coding = LineCoding::Framed;
+        }
+        return std::make_unique<PhyDriver>(io, spec.substr(4));
+    }
+    throw std::invalid_argument("unknown link " + spec + ", expected b15f, ard:<device> or phy:<device>");
+}
+
+
+
+int finishCalibration(Calibrator & calibrator, const LinkOptions & options, const std::string & profile)     //after our sweep went out: waits a while for the partner's report, prints and saves the result
+{
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(uint64_t(options.base_period_us) * 12 * REPORT_REPEATS * 2);
+    while(!calibrator.partnerReported() && std::chrono::steady_clock::now() < deadline)
+    {
+        std::this_thread::sleep_for(std::chrono::microseconds(options.base_period_us));
+    }
+    calibrator.report(std::cout);
+    calibrator.saveProfile(profile);
+    std::cerr << "profile written to " << profile << std::endl;
+    std::cout.flush();
+    std::_Exit(0);          //a receive side without a report is still blocked on the wire
+}
+
+
+
+int runCalibration(LinkScheduler & scheduler, const LinkOptions & options, const std::string & profile)       //-calibrate on a real link, the partner runs it at the same time
+{
+    Calibrator calibrator(scheduler, options);
+    std::thread receiving(&Calibrator::receive, &calibrator);
+    calibrator.transmit();
+    receiving.detach();
+    return finishCalibration(calibrator, options, profile);
+}
+
+
+
+int runLoopbackCalibration(const LinkOptions & options, double error_rate, const std::string & profile)      //both peers of -calibrate over an in-process wire, the profile is side 0's
+{
+    LoopbackWire wire;
+    wire.error_rate = error_rate;
+    LoopbackDriver link_a(wire, 0);
+    LoopbackDriver link_b(wire, 1);
+    LinkScheduler scheduler_a(link_a, options);
+    LinkScheduler scheduler_b(link_b, options);
+    Calibrator a(scheduler_a, options);
+    Calibrator b(scheduler_b, options);
+
+    std::thread receiving_a(&Calibrator::receive, &a);
+    std::thread receiving_b(&Calibrator::receive, &b);
+    std::thread transmitting_b(&Calibrator::transmit, &b);
+    a.transmit();
+    transmitting_b.join();
+    receiving_a.detach();
+    receiving_b.detach();
+    return finishCalibration(a, options, profile);
+}
+
+
 
 int main(int argc, char** argv)
 {
     // bool list_mode = false;
-    TimedQueue pending_ack;
-    TimedQueue ack_queue;
-    TimedQueue neg_ack_queue;
-    std::atomic<bool> established(false);
-    std::atomic<bool> listening(false);
-    std::atomic<bool> partner_finished(false);
-    std::mutex hardware_lock;
-    hardware_lock.unlock();
     int mode = 0;
+    LinkOptions options;
+    double error_rate = 0;
+    unsigned int baud = 115200;
+    std::string profile = PROFILE_PATH;
+    bool calibrate = false;
+    std::string links;                  //-links: a count for -loop, a comma separated list for -bond
+    uint32_t link_count = 0;            //-links under -loop
+    uint32_t cut_ms = 0;
+    std::ios::sync_with_stdio(false);       //buffered cin, so the reader thread sees with in_avail() how much input is already there
 
     if (argc > 1) {
         // Compare the arguments with strcmp for correct string comparison
-        if (strcmp(argv[1], "-b15f") == 0) { 
-            mode = 1; 
+        if (strcmp(argv[1], "-b15f") == 0) {
+            mode = 1;
+        }
+        else if (strcmp(argv[1], "-ard") == 0) {
+            mode = 2;
         }
-        else if (strcmp(argv[1], "-ard") == 0) { 
-            mode = 2; 
+        else if (strcmp(argv[1], "-loop") == 0) {
+            mode = 3;
+        }
+        else if (strcmp(argv[1], "-phy") == 0) {
+            mode = 4;
+        }
+        else if (strcmp(argv[1], "-bond") == 0) {
+            mode = 5;
+        }
+        else if (strcmp(argv[1], "-bench") == 0) {
+            return runBenchmark(argc > 2 ? argv[2] : "");
+        }
+
+        for (int i = 2; i + 1 < argc; i += 2) {        //the profile first, so the flags below can still override it
+            if (strcmp(argv[i], "-profile") == 0) {
+                profile = argv[i + 1];
+            }
+            else if (strcmp(argv[i], "-calibrate") == 0) {
+                calibrate = strcmp(argv[i + 1], "on") == 0;       //both peers at once, writes the profile instead of transferring
+            }
+        }
+        if (!calibrate) {
+            loadProfile(profile, options);
+        }
+
+        int i = 2;
+        try {
+            for (; i + 1 < argc; i += 2) {
+                if (strcmp(argv[i], "-window") == 0) {
+                    options.max_window = std::stoul(argv[i + 1]);
+                }
+                else if (strcmp(argv[i], "-timeout") == 0) {
+                    options.ack_timeout_stacks = std::stoul(argv[i + 1]);
+                }
+                else if (strcmp(argv[i], "-recvwindow") == 0) {
+                    options.receive_window = std::stoul(argv[i + 1]);
+                }
+                else if (strcmp(argv[i], "-checksum") == 0) {
+                    options.checksum = strcmp(argv[i + 1], "crc16") == 0 ? ChecksumType::Crc16 : ChecksumType::Crc32c;
+                }
+                else if (strcmp(argv[i], "-fec") == 0) {
+                    options.fec = strcmp(argv[i + 1], "on") == 0;
+                }
+                else if (strcmp(argv[i], "-period") == 0) {
+                    options.base_period_us = std::stoul(argv[i + 1]) * 1000;      //ms, both peers need the same
+                }
+                else if (strcmp(argv[i], "-minperiod") == 0) {
+                    options.min_period_us = std::stoul(argv[i + 1]) * 1000;
+                }
+                else if (strcmp(argv[i], "-coding") == 0) {
+                    options.line_coding = strcmp(argv[i + 1], "transition") == 0 ? LineCoding::Transition : LineCoding::Framed;      //both peers need the same
+                }
+                else if (strcmp(argv[i], "-compress") == 0) {
+                    options.compression = strcmp(argv[i + 1], "fast") == 0 ? Compression::Fast : strcmp(argv[i + 1], "strong") == 0 ? Compression::Strong : Compression::Off;
+                }
+                else if (strcmp(argv[i], "-oversample") == 0) {
+                    options.oversampling = std::stoul(argv[i + 1]);     //samples per symbol, up to 16
+                }
+                else if (strcmp(argv[i], "-wide") == 0) {
+                    options.wide_bus = strcmp(argv[i + 1], "on") == 0;        //only b15f and -loop can turn their lines around
+                }
+                else if (strcmp(argv[i], "-hunt") == 0) {
+                    options.hunt_limit = std::stoul(argv[i + 1]);       //0 resyncs on every broken stack
+                }
+                else if (strcmp(argv[i], "-grid") == 0) {
+                    options.slot_grid_us = std::stoul(argv[i + 1]);        //us between scheduler ticks
+                }
+                else if (strcmp(argv[i], "-baud") == 0) {
+                    baud = std::stoul(argv[i + 1]);             //only used by -ard, the firmware starts at 9600
+                }
+                else if (strcmp(argv[i], "-noise") == 0) {
+                    error_rate = std::stod(argv[i + 1]);       //only used by -loop
+                }
+                else if (strcmp(argv[i], "-links") == 0) {
+                    links = argv[i + 1];
+                    if (mode == 3) {
+                        link_count = std::max<uint32_t>(std::stoul(links), 1);      //-loop takes a count of wires
+                    }
+                }
+                else if (strcmp(argv[i], "-cut") == 0) {
+                    cut_ms = std::stoul(argv[i + 1]);           //ms until -loop pulls the first of its bonded wires
+                }
+            }
+        }
+        catch (const std::exception &) {        //std::stoul or std::stod got something that is no number
+            std::cerr << "invalid value " << argv[i + 1] << " for " << argv[i] << std::endl;
+            return -1;
         }
 
         // If there's a third argument, check for "-l"
-        // if (argc > 2 && strcmp(argv[2], "-l") == 0) { 
+        // if (argc > 2 && strcmp(argv[2], "-l") == 0) {
         //     list_mode = true;  // Start listening-only mode
         // }
     }
@@ -33,47 +390,105 @@ int main(int argc, char** argv)
     if(mode == 0)
     {return -1;}
 
+    if((mode == 3 && links.size() > 0) || mode == 5)
+    {
+        if(calibrate)
+        {
+            std::cerr << "calibrate each link on its own" << std::endl;
+            return -1;
+        }
+        if(options.compression != Compression::Off)
+        {
+            std::cerr << "a bonded transfer is not compressed, the links carry its chunks in any order" << std::endl;
+            options.compression = Compression::Off;
+        }
+    }
+
+    if(mode == 3)
+    {
+        if(links.size() > 0)
+        {return runBondedLoopback(options, error_rate, link_count, cut_ms);}
+        return calibrate ? runLoopbackCalibration(options, error_rate, profile) : runLoopback(options, error_rate);
+    }
+
     boost::asio::io_context io;
-    boost::asio::serial_port serial(io);  // Declare serial port outside switch
-    boost::asio::serial_port* serial_ptr = nullptr;
-    B15F* b15f_ptr = nullptr;
+    std::unique_ptr<LinkDriver> link;
 
-    // Initialize B15F and serial outside of the switch block to avoid jumping across initialization
-    if (mode == 1) 
+    if (mode == 5)
     {
-        B15F& b15f = B15F::getInstance();
-        b15f_ptr = &b15f;
-        b15f_ptr->setRegister(&DDRA, 0x0F);  // Assuming DDRA is defined elsewhere
-    } 
-    else if (mode == 2) 
+        if(links.find("b15f") != links.rfind("b15f"))
+        {
+            std::cerr << "the b15f library drives one board per process, bond it with serial links" << std::endl;
+            return -1;
+        }
+        std::vector<std::unique_ptr<LinkDriver>> bonded;
+        std::stringstream list(links);
+        std::string spec;
+        while(std::getline(list, spec, ','))
+        {
+            bonded.push_back(openLink(spec, io, baud, options));
+        }
+        if(bonded.empty())
+        {
+            std::cerr << "-bond needs -links, e.g. -links b15f,ard:/dev/ttyUSB1" << std::endl;
+            return -1;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(5000));
+        return runBonded(bonded, io, options);
+    }
+
+    if (mode == 1)
+    {
+        link = std::make_unique<B15FDriver>(B15F::getInstance());
+    }
+    else if (mode == 2)
+    {
+        link = std::make_unique<ArduinoDriver>(io, "/dev/ttyUSB1", baud);
+    }
+    else if (mode == 4)
     {
-        serial_ptr = &serial;
-        serial_ptr->open("/dev/ttyUSB1");  // Open serial port
-        serial_ptr->set_option(boost::asio::serial_port_base::baud_rate(9600));
-        serial_ptr->set_option(boost::asio::serial_port_base::character_size(8));
-        serial_ptr->set_option(boost::asio::serial_port_base::parity(boost::asio::serial_port_base::parity::none));
-        serial_ptr->set_option(boost::asio::serial_port_base::stop_bits(boost::asio::serial_port_base::stop_bits::one));
-        serial_ptr->set_option(boost::asio::serial_port_base::flow_control(boost::asio::serial_port_base::flow_control::none));
+        link = std::make_unique<PhyDriver>(io, "/dev/ttyUSB1");
+        if(options.line_coding != LineCoding::Framed)
+        {
+            std::cerr << "ardphy only speaks the framed coding, using it" << std::endl;
+            options.line_coding = LineCoding::Framed;
+        }
     }
 
     // std::cout << "Program starting..." << std::endl;
 
     std::this_thread::sleep_for(std::chrono::milliseconds(5000));  // Small delay before starting transmission
 
-    // Create Receiver and Transmitter instances with the appropriate pointers
-    Receiver r(b15f_ptr, serial_ptr, pending_ack, ack_queue, neg_ack_queue, established, listening, partner_finished, hardware_lock, mode);
-    Transmitter t(b15f_ptr, serial_ptr, pending_ack, ack_queue, neg_ack_queue, established, listening, partner_finished, hardware_lock, mode);
-    
+    // Create Receiver and Transmitter instances on the chosen link
+    LinkEngine engine(io);          //only now, the drivers used io for their setup
+    if(calibrate)
+    {
+        if(link->capabilities().coded)
+        {
+            std::cerr << "ardphy times its own samples, there is nothing to calibrate" << std::endl;
+            return -1;
+        }
+        LinkScheduler scheduler(*link, options);
+        return runCalibration(scheduler, options, profile);
+    }
+    Peer peer(*link, std::cin, std::cout, options);
+
     try
     {
-        std::thread receiver_thread(&Receiver::beginListening, &r);
+        std::thread receiver_thread(&Receiver::beginListening, &peer.receiver);
         std::this_thread::sleep_for(std::chrono::milliseconds(1000));  // Small delay before starting transmission
-        std::thread transmitter_thread(&Transmitter::beginTransmission, &t);
+        std::thread transmitter_thread(&Transmitter::beginTransmission, &peer.transmitter);
         transmitter_thread.join();
+        reportJitter("link", peer.scheduler);
         receiver_thread.detach();
+        std::cout.flush();
+        std::_Exit(peer.state.aborted.load() ? 1 : 0);          //the receiver is still blocked on the scheduler, destroying the peer under it would break its pending read
     }
 
-    catch(const std::exception& e){;}
+    catch(const std::exception& e)
+    {
+        std::cerr << "transfer failed: " << e.what() << std::endl;
+    }
 
-    return 0;
-}
\ No newline at end of file
+    return -1;
+}
@@ -16,126 +16,135 @@
 #include <b15f/b15f.h>
 #include <unordered_set>
 #include <deque>
+#include <functional>
+#include <map>
+#include <random>
+#include <limits>
+#include <cstdlib>
+#include "crc.cpp"
+#include "fec.cpp"
+#include "compress.cpp"
+#include "channel.cpp"
 
 
 
-const uint32_t HEADER_SIZE = 16;
+const uint32_t HEADER_SIZE = 32;            //header bytes before the payload plus the trailing ETX
 const uint32_t BYTE_PER_PACKAGE = 64;      //256 bytes usually
 const uint32_t BYTE_BETWEEN_SYNC = 4;
-const uint32_t SEND_DELAY = 60;
+const uint32_t SEND_DELAY = 60;             //ms per nibble every session starts with
+const uint32_t PERIOD_UNIT_US = 10;         //resolution of the period fields in a stack
+const uint32_t SACK_BITS = 32;              //sequence numbers after the cumulative ACK covered by the bitmap
+const uint32_t FEC_PARITY = 8;              //Reed-Solomon bytes after the ETX of a FEC stack, repairs 4 bad bytes
+const uint8_t FORMAT_FEC = 0xF0;            //high nibble of the format byte, all four lines so one bad line cant hide it
+const uint8_t FORMAT_CHECKSUM = 0x07;       //low bits of the format byte, the ChecksumType
+const uint8_t FORMAT_COMPRESSED = 0x08;     //the payload belongs to a stream of compressed blocks
+const uint8_t CAP_FEC = 0x01;               //the receiver can decode FEC stacks
+const uint8_t CAP_COMPRESS = 0x02;          //the receiver can decompress block streams
+const uint8_t CAP_WIDE = 0x04;              //the sender can lend and borrow all 8 lines, see LinkOptions::wide_bus
+const uint8_t FLAG_FINISHED = 0x10;         //caps byte of a control stack: the sender's input ended and the partner acknowledged all of it
+const uint8_t FLAG_SAW_FINISHED = 0x20;     //caps byte: the sender's receiver got the partner's FLAG_FINISHED
+const uint8_t FLAG_ABORTED = 0x40;          //caps byte: the sender gave up on the session, the partner ends it as well
+const uint32_t WIDE_GUARD = 6;              //symbol periods between the last symbol the partner puts on lines we take over and our first one
+
+//byte positions inside a stack
+const uint32_t POS_FORMAT = 1;              //ChecksumType the stack is protected with, FORMAT_FEC if parity follows, FORMAT_COMPRESSED
+const uint32_t POS_SEQUENCE = 2;            //4 byte sequence number of the payload
+const uint32_t POS_ACK_TYPE = 6;            //0x06 ACK, 0x15 NAK if the NAK field is in use
+const uint32_t POS_CUMULATIVE_ACK = 7;      //4 byte, every sequence number below was received
+const uint32_t POS_SACK = 11;               //4 byte selective ACK bitmap
+const uint32_t POS_NAK = 15;                //4 byte sequence number received with a bad checksum
+const uint32_t POS_LENGTH = 19;             //used bytes of the payload, the rest is padding
+const uint32_t POS_WINDOW = 20;             //stacks the sender can buffer beyond its cumulative ACK
+const uint32_t POS_CAPS = 21;               //CAP_ flags of what the sender's receiver understands, the FLAG_ bits of the end of the session
+const uint32_t POS_PERIOD = 22;             //2 byte symbol period the sender uses from the next stack on, in PERIOD_UNIT_US
+const uint32_t POS_PERIOD_ECHO = 24;        //2 byte period the sender's receiver decoded the last stack at, 0 if it failed the checksum
+const uint32_t POS_CHECKSUM = 26;           //4 byte CRC over the whole stack except this field
+const uint32_t POS_TEXT = 30;               //STX, the payload follows
+
+
+
+enum class LineCoding : uint8_t     //how groups of BYTE_BETWEEN_SYNC bytes are put on the lines, see linecoder.cpp
+{
+    Framed = 0,         //every group wrapped in a 0x0F,0x00 lead-in and 0x00,0x0F lead-out, sampled at a fixed period after the edge
+    Transition = 1,     //every symbol differs from the one before, the receiver clocks on each change
+};
 
 
 
-class TimedQueue 
+inline uint32_t stackChecksum(ChecksumType type, const uint8_t* stack)     //CRC of a complete stack, skipping the checksum field itself
 {
-private:
-    std::queue<uint32_t> queue;
-    std::unordered_set<uint32_t> set; // Auxiliary set to track unique values
-    std::timed_mutex mutex;
-
-public:
-    bool push(uint32_t value) 
+    const uint8_t* rest = stack + POS_CHECKSUM + 4;
+    size_t rest_length = HEADER_SIZE + BYTE_PER_PACKAGE - POS_CHECKSUM - 4;
+    if(type == ChecksumType::Crc16)
     {
-        if (mutex.try_lock_for(std::chrono::milliseconds(100))) 
-        {
-            // Check if the value is already in the set (and therefore the queue)
-            if (set.find(value) != set.end()) 
-            {
-                mutex.unlock();
-                return false; // Value already exists, do not push
-            }
-
-            // Push the value to the queue and add it to the set
-            queue.push(value);
-            set.insert(value);
-            mutex.unlock();
-            return true; // Successfully pushed
-        } 
-        else 
-        {
-            return false; // Timed out
-        }
+        return crc16(rest, rest_length, crc16(stack, POS_CHECKSUM));
     }
+    return crc32c(rest, rest_length, crc32c(stack, POS_CHECKSUM));
+}
 
-    std::optional<uint32_t> pop() 
-    {
-        if (mutex.try_lock_for(std::chrono::milliseconds(100))) 
-        {
-            if (!queue.empty()) 
-            {
-                uint32_t value = queue.front();
-                queue.pop();
-                set.erase(value); // Remove from set since it's no longer in the queue
-                mutex.unlock();
-                return value; // Successfully popped
-            } 
-            else 
-            {
-                mutex.unlock();
-                return std::nullopt; // Queue was empty
-            }
-        } 
-        else 
-        {
-            return std::nullopt; // Timed out
-        }
-    }
 
-    bool remove(uint32_t value) 
-    {
-        if (mutex.try_lock_for(std::chrono::milliseconds(100))) 
-        {
-            std::deque<uint32_t> tempDeque;
-            bool found = false;
-
-            // Iterate over the queue and move elements to tempDeque, skipping the one to remove
-            while (!queue.empty()) 
-            {
-                if (queue.front() == value && !found) 
-                {
-                    found = true; // Skip adding the value to tempDeque
-                } 
-                else 
-                {
-                    tempDeque.push_back(queue.front()); // Add all other values to tempDeque
-                }
-                queue.pop();
-            }
-
-            // Refill the original queue with the modified tempDeque
-            for (auto val : tempDeque) 
-            {
-                queue.push(val);
-                set.insert(val); // Insert back into the set
-            }
-
-            // If the value was found, remove it from the set
-            if (found) 
-            {
-                set.erase(value);
-            }
-
-            mutex.unlock();
-            return found;
-        } 
-        else 
-        {
-            return false; // Timed out
-        }
-    }
 
-    bool empty() 
-    {
-        return queue.empty();
-    }
+struct LinkOptions                  //runtime settings both peers are started with
+{
+    uint32_t initial_window = 4;            //stacks in flight at the start of a session
+    uint32_t min_window = 1;
+    uint32_t max_window = 32;               //upper bound for the adaptive send window
+    uint32_t ack_timeout_stacks = 4;        //stack airtimes to wait for an ACK before resending
+    uint32_t send_buffer_size = 64 * 1024;  //input bytes read ahead of the window
+    uint32_t receive_window = 32;           //out of order stacks the receiver keeps, at most 255
+    ChecksumType checksum = ChecksumType::Crc32c;       //what our stacks are protected with, the receiver follows the sender
+    bool fec = false;                       //add Reed-Solomon parity to our stacks once the partner reported it can decode it
+    uint32_t base_period_us = SEND_DELAY * 1000;        //symbol period of the handshake and after every resync, has to match the partner
+    uint32_t min_period_us = 10 * 1000;     //fastest symbol period we send at
+    uint32_t speedup_after = 8;             //confirmed stacks before the symbol period is shortened again
+    LineCoding line_coding = LineCoding::Framed;        //has to match the partner, the handshake is already coded
+    Compression compression = Compression::Off;         //compress our input once the partner reported it can decompress it
+    uint32_t slot_grid_us = 250;            //LinkScheduler carries out device accesses on ticks this far apart
+    uint32_t sample_phase = 2;              //sixths of a symbol between the poll that saw the lead-in edge and the samples, -calibrate measures it
+    uint32_t oversampling = 1;              //samples per symbol the receiver takes and votes over, a DPLL keeps them centred, 1 samples once
+    uint32_t hunt_limit = 4;                //broken stacks in a row the receiver hunts through for the next one before it asks for a full resync
+    bool wide_bus = false;                  //half duplex bursts on all 8 lines while only one side has data, once both advertised CAP_WIDE
+};
+
+
+
+enum class WideBus : uint8_t        //who drives the 8 lines of a link, see LinkOptions::wide_bus
+{
+    Split,              //4 lines each way
+    Requested,          //our transmitter asked the partner for its lines and waits for the grant
+    Borrowed,           //the partner granted, our transmitter drives all 8 lines until its release frame
+    Lending,            //our receiver accepted the partner's request, our transmitter grants after its current stack
+    Lent,               //our lines listen, our receiver reads the partner's burst
+};
+
 
-    int size() 
-    {
-        return queue.size();
-    }
 
-    uint32_t front() 
+struct LinkState                    //runtime values the Receiver and Transmitter of one peer share besides the queues
+{
+    static constexpr std::chrono::steady_clock::rep NOT_ECHOED = std::numeric_limits<std::chrono::steady_clock::rep>::max();
+
+    std::atomic<uint32_t> receive_window;   //advertised to the partner in every stack
+    std::atomic<uint32_t> partner_window;   //last window the partner advertised
+    std::atomic<uint8_t> partner_caps{0};   //CAP_ flags the partner advertised
+    std::atomic<bool> partner_heard{false}; //partner_caps is valid, a stack from the partner passed its checksum
+    std::atomic<std::chrono::steady_clock::rep> partner_heard_at{0};        //when the last one did
+    std::atomic<bool> partner_saw_finished{false};  //the partner's last stack said it got our FLAG_FINISHED
+    std::atomic<bool> aborted{false};               //our receiver or the partner gave up on the session, main exits non-zero
+    std::atomic<bool> partner_aborted{false};       //a stack from the partner carried FLAG_ABORTED
+    const uint32_t base_period_us;          //period of the handshake, both directions fall back to it on resync
+    std::atomic<uint32_t> rx_period_us;     //period our receiver samples the partner's nibbles at
+    std::atomic<uint32_t> rx_echo_us{0};    //period the partner announced for its next stacks, echoed back as ready for it; 0 if its last stack was corrupted
+    std::atomic<uint32_t> rx_pending_us{0}; //announced period the partner has not switched to yet as far as we know, 0 if none
+    std::atomic<std::chrono::steady_clock::rep> pending_echoed{NOT_ECHOED};     //when our transmitter finished the first stack that echoed rx_pending_us
+    std::atomic<uint32_t> partner_echo_us{0};       //what the partner echoed about our last stack
+    std::atomic<uint32_t> partner_echoes{0};        //counts echoes received so the transmitter sees every new one
+    std::atomic<WideBus> bus{WideBus::Split};
+    std::atomic<bool> tx_idle{false};               //our transmitter has no package to send or to wait for, so it can lend its lines
+    std::atomic<bool> partner_sending{true};        //the partner's last stack carried a package, until we know better
+
+    explicit LinkState(const LinkOptions & options)
+        : receive_window(std::clamp<uint32_t>(options.receive_window, 1, 255)), partner_window(receive_window.load()), base_period_us(options.base_period_us), rx_period_us(options.base_period_us)
     {
-        return queue.front();
+
     }
 };
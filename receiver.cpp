@@ -1,30 +1,74 @@
 #include "netkitten.cpp"
+#include "linkdriver.cpp"
+#include "linkengine.cpp"
+#include "acktracker.cpp"
+#include "linecoder.cpp"
+#include "stackparser.cpp"
+#include "bond.cpp"
 
 
 
 class Receiver
 {
     private:
-    B15F* b15f;
-    boost::asio::serial_port* serial;
-    TimedQueue & pending_ack;           //stores the sequence_num's which havn't been acknowledged yet
-    TimedQueue & ack_queue;             //stores the acknowledgments which still need to be sent
-    TimedQueue & neg_ack_queue;         //stores negative acknowledgments which need to be sent
+    LinkDriver & link;
+    std::ostream & output;
+    Channel<AckReport> & ack_reports;   //what the partner acknowledged, receiver to transmitter
+    UniqueChannel<uint32_t> & ack_queue;      //stores the acknowledgments which still need to be sent
+    UniqueChannel<uint32_t> & neg_ack_queue;  //stores negative acknowledgments which need to be sent
+    UniqueChannel<uint32_t> & resend_queue;   //stores the sequence_num's the partner reported corrupted
     std::atomic<bool> & established;              //is sent data received
     std::atomic<bool> & listening;                //is own receiver currently reading data
     std::atomic<bool> & partner_finished;         //does other client finished transmission
-    std::mutex & hardware_lock;
-    int mode = 0;
+    LinkScheduler & scheduler;          //owns the device, every sample goes through it
+    LinkState & state;
+    const LinkOptions & options;
 
     unsigned short currentState;
-    std::vector<uint8_t> read_buffer;                //reads tetra bits in order which they arrived
-    std::vector<uint8_t> transmission_content;       //perceived transmission content
+    StackParser parser;                              //the stack being read, checked field by field as it arrives
+    uint32_t next_delivery = 0;                      //sequence number the output waits for
+
+    struct HeldPayload                               //a package received ahead of next_delivery
+    {
+        uint32_t sequence;
+        bool used = false;
+        bool compressed;
+        uint8_t length;
+        std::array<uint8_t, BYTE_PER_PACKAGE> bytes;
+    };
+    static constexpr uint32_t REORDER_SLOTS = 256;   //receive_window is a byte, held sequence numbers never lie REORDER_SLOTS apart
+    static constexpr uint32_t BURST_TIMEOUT_POLLS = 6 * 24;     //polls without a lead-in on the turned bus until the partner's burst counts as over
+    std::vector<HeldPayload> reorder;                //by sequence number, allocated once
+    uint32_t hunts = 0;                              //broken stacks in a row the receiver hunted through without a resync
+    uint32_t period_hold = 0;                        //groups a guessed period gets before the other one is tried again, see followPeriod
+    SequenceSet taken;                               //sequence numbers whose payload was kept, a duplicate is dropped before it is copied
+    StreamDecompressor decompressor;
+    std::vector<uint8_t> decompressed;
+    std::unique_ptr<LineCoder> coder;                //how the partner's byte groups look on the wire
+    NibbleReader wire;
+    WideCoder wide_coder;                            //the partner's bursts while it has our lines
+    NibbleReader wide_wire;                          //all 8 lines instead of 4
+    std::chrono::steady_clock::time_point next_sample;       //slot of the next sample, samples follow each other back to back
+    Bond * bond;                                     //payloads go to the bond's reassembly instead of output, nullptr on a single link
 
 
     public:
-    Receiver(B15F* board, boost::asio::serial_port* ser, TimedQueue & pen_ack, TimedQueue & ack_q, TimedQueue & neg_ack_q, std::atomic<bool> & es, std::atomic<bool> & li, std::atomic<bool> & pf, std::mutex & hl, int mo)
-        : b15f(board), serial(ser), pending_ack(pen_ack), ack_queue(ack_q), neg_ack_queue(neg_ack_q), established(es), listening(li), partner_finished(pf), hardware_lock(hl), mode(mo)
+    Receiver(LinkDriver & drv, std::ostream & out, Channel<AckReport> & reports, UniqueChannel<uint32_t> & ack_q, UniqueChannel<uint32_t> & neg_ack_q, UniqueChannel<uint32_t> & res_q, std::atomic<bool> & es, std::atomic<bool> & li, std::atomic<bool> & pf, LinkScheduler & sch, LinkState & ls, const LinkOptions & opt, Bond * bd = nullptr)
+        : link(drv), output(out), ack_reports(reports), ack_queue(ack_q), neg_ack_queue(neg_ack_q), resend_queue(res_q), established(es), listening(li), partner_finished(pf), scheduler(sch), state(ls), options(opt), reorder(REORDER_SLOTS), coder(makeLineCoder(opt.line_coding, opt.oversampling, opt.sample_phase)), wide_coder(opt.sample_phase), bond(bd)
     {
+        wire.sample = [this] { return readTetraPack(); };
+        wire.poll = [this] { return fastReadTetraPack(); };
+        wire.samples = [this](uint8_t* half_bytes, size_t count) { readTetraPacks(half_bytes, count); };
+        wire.oversamples = [this](uint8_t* half_bytes, size_t count, uint32_t per_symbol) { readTetraPacks(half_bytes, count, per_symbol); };
+        wide_wire.sample = [this] { return scheduler.readWide(nextSlot(std::chrono::microseconds(state.rx_period_us.load()))); };
+        wide_wire.poll = [this] { return scheduler.readWide(nextSlot(pollPeriod())); };
+        wide_wire.samples = [this](uint8_t* symbols, size_t count)
+        {
+            for(size_t i = 0; i < count; i++)
+            {
+                symbols[i] = wide_wire.sample();
+            }
+        };
 
     }
 
@@ -36,31 +80,13 @@ class Receiver
 
         while(currentState != 0)            //receiving main loop
         {
-            switch (currentState)           //1=sync, 2=switch await, 3=reading
+            switch (currentState)           //1=sync, 3=reading
             {
             case 1:
                 // std::cout << "Receiver Sync" << std::endl;
                 syncListen();
                 continue;
 
-            case 2:
-                if(partner_finished.load())
-                {
-                    currentState = 3;               //go back to listening for transmission was already stored
-                    continue;
-                }
-                // std::cout << "Received Content: ";
-                transmission_content.erase(transmission_content.end() - transmission_content.back(), transmission_content.end());        //output all bytes from the transmission
-                for(uint8_t byte:transmission_content)
-                {
-                    std::cout.write(reinterpret_cast<const char*>(&byte), 1);
-                }
-                std::cout.flush();
-                // std::cout << "Partner Finished with EOT" << std::endl;
-                partner_finished.store(true);   //store that transmission was fully received
-                currentState = 3;               //go back to listening in another transmission is sent
-                continue;
-
             case 3:
                 // std::cout << "Receiving Comms" << std::endl;
                 receiveTransmission();
@@ -78,33 +104,29 @@ class Receiver
 
     void syncListen()
     {
+        state.rx_period_us.store(state.base_period_us);       //the partner resyncs at the base period as well
+        state.rx_pending_us.store(0);
         while(!(established.load() && listening.load()))
         {
-            read_buffer.clear();
-            awaitSwitch();      //try to catch falling edge
-            
-            for(uint32_t i = 0; i < BYTE_BETWEEN_SYNC; i++)         
-            {
-                read_buffer.push_back(readTetraPack());
-            }
+            std::array<uint8_t, BYTE_BETWEEN_SYNC> group{};
+            readGroup(group.data());
 
-            switch(determineCase())
+            switch(determineCase(group))
             {
             case 1:             //buffer was full with SYNC
                 listening.store(true);
                 established.store(false);
-                read_buffer.clear();
                 continue;
 
             case 2:             //buffer was full with ACK
                 listening.store(true);
                 established.store(true);
-                read_buffer.clear();
+                parser.reset();
+                hunts = 0;
                 currentState = 3;           //everything synced up and now reading data
                 return;
 
             case 3:             //buffer didnt match a mask
-                read_buffer.clear();
                 continue;
             }
         }
@@ -112,30 +134,14 @@ class Receiver
 
 
 
-    int determineCase() 
+    int determineCase(const std::array<uint8_t, BYTE_BETWEEN_SYNC> & group)         //a whole group of SYNC idles or ACKs
     {
-        bool is_sync = true; 
-        bool is_ack = true;  
-
-        for (size_t i = 1; i < read_buffer.size(); ++i) {
-            if (i % 2 == 0) {
-                if (read_buffer[i] != 0b0110) {
-                    return 3;  
-                }
-            } else {
-                if (read_buffer[i] != 0b0001) {
-                    is_sync = false;  // Fails SYNC pattern
-                }
-                if (read_buffer[i] != 0x00) {
-                    is_ack = false;  // Fails ACK pattern
-                }
-            }
-        }
-
-        if (is_sync) {
+        if(std::all_of(group.begin(), group.end(), [](uint8_t byte) { return byte == 0x16; }))
+        {
             return 1;  // SYNC case
-        } 
-        if (is_ack) {
+        }
+        if(std::all_of(group.begin(), group.end(), [](uint8_t byte) { return byte == 0x06; }))
+        {
             return 2;  // ACK case
         }
         return 3;  // General failure case
@@ -143,283 +149,398 @@ class Receiver
 
 
 
-
-    void awaitSwitch() 
+    bool readGroup(uint8_t* bytes)      //the next group of BYTE_BETWEEN_SYNC bytes from the partner
     {
-        uint8_t prevByte = 0xFF; // Initialize to an invalid value
-        uint8_t currentByte;
-
-        while (true) 
+        if(link.capabilities().coded)       //the device decodes and times it, nothing for the scheduler to interleave
         {
-            currentByte = fastReadTetraPack();
-
-            if (prevByte == 0x0F && currentByte == 0x00) 
-            {
-                //exit on falling edge
-                std::this_thread::sleep_for(std::chrono::milliseconds(10));
-                return;
-            } 
-            else
-            {
-                prevByte = currentByte;
-                continue;
-            }
+            return link.readGroup(bytes, std::chrono::microseconds(state.rx_period_us.load()));
         }
+        return coder->decodeGroup(wire, bytes);
     }
 
 
 
     uint8_t readTetraPack()
     {
-        using namespace std::chrono;
-        auto now = steady_clock::now();
-        auto nextTick = now + milliseconds(SEND_DELAY);
-        uint8_t incoming = 0;
+        return scheduler.read(nextSlot(std::chrono::microseconds(state.rx_period_us.load())));     //read the 4 incoming lines
+    }
 
-        while(true) 
+
+
+    void readTetraPacks(uint8_t* half_bytes, size_t count, uint32_t per_symbol = 1)     //a run of samples per_symbol to a symbol period, timed by the device if it can
+    {
+        std::chrono::microseconds period(state.rx_period_us.load() / per_symbol);
+        if(!link.capabilities().batch)
         {
-            if(hardware_lock.try_lock())
+            for(size_t i = 0; i < count; i++)
             {
-                switch (mode)
-                {
-                case 1:
-                    incoming = b15f->getMem8(&PINA);        //read memory from PINA
-                    incoming = (incoming >> 4);
-                    hardware_lock.unlock();
-                    std::this_thread::sleep_until(nextTick);
-                    return (incoming);
-                    break;
-                
-                case 2:
-                    // Sende Kommando
-                    const char command = 'R';
-                    boost::asio::write(*serial, boost::asio::buffer(&command, 1));
-                    boost::system::error_code error;
-                    boost::asio::read(*serial, boost::asio::buffer(&incoming, 1), error);
-                    if (error) {
-                        // std::cout << "Error: " << error.message() << std::endl;
-                    }
-                    hardware_lock.unlock();
-                    std::this_thread::sleep_until(nextTick);
-                    return (incoming);
-                    break;
-                }
+                half_bytes[i] = scheduler.read(nextSlot(period));
             }
-        } 
+            return;
+        }
+
+        scheduler.readNibbles(half_bytes, count, period, nextSlot(period * count));
+        for(size_t i = 0; i < count; i++)
+        {
+            half_bytes[i] &= 0x0F;
+        }
     }
 
 
 
     uint8_t fastReadTetraPack()
     {
-        using namespace std::chrono;
-        auto now = steady_clock::now();
-        auto nextTick = now + milliseconds(10);
-        uint8_t incoming = 0;
-
-        while(true) 
+        if(parser.between())
         {
-            if(hardware_lock.try_lock())
-            {
-                switch (mode)
-                {
-                case 1:
-                    incoming = b15f->getMem8(&PINA);        //read memory from PINA
-                    incoming = (incoming >> 4);
-                    hardware_lock.unlock();
-                    std::this_thread::sleep_until(nextTick);
-                    return (incoming);
-                    break;
-                
-                case 2:
-                    // Sende Kommando
-                    const char command = 'R';
-                    boost::asio::write(*serial, boost::asio::buffer(&command, 1));
-                    boost::system::error_code error;
-                    boost::asio::read(*serial, boost::asio::buffer(&incoming, 1), error);
-                    if (error) {
-                        // std::cout << "Error: " << error.message() << std::endl;
-                    }
-                    hardware_lock.unlock();
-                    std::this_thread::sleep_until(nextTick);
-                    return (incoming);
-                    break;
-                }
-            }
-        } 
+            followEcho();               //the partner may begin its next stack at the new period while we wait for it
+        }
+        return scheduler.read(nextSlot(pollPeriod()));
+    }
+
+
+
+    std::chrono::steady_clock::time_point nextSlot(std::chrono::steady_clock::duration length)      //the slot after the last one, or right away after a pause
+    {
+        auto slot = std::max(next_sample, std::chrono::steady_clock::now());
+        next_sample = slot + length;
+        return slot;
     }
 
 
 
-    uint8_t combine4BitValues(uint8_t first, uint8_t second) 
+    std::chrono::microseconds pollPeriod() const        //edge search resolution, a sixth of a nibble
     {
-        first &= 0x0F;  
-        second &= 0x0F; 
-        return (first << 4) | second;
+        return std::chrono::microseconds(state.rx_period_us.load() / 6);
     }
 
 
 
     void receiveTransmission()
     {
-        awaitSwitch();
-        readTetraPack();        //first read gets scrapped because its only for syncing purpouses
-        
-        for(uint32_t i = 0; i < BYTE_BETWEEN_SYNC; i++)      //reads BYTE_BETWEEN_SYNC amounts of bytes
+        while(state.bus.load() == WideBus::Borrowed)        //our own burst is on all lines, nothing from the partner until it is over
         {
-            uint8_t first = readTetraPack();
-            uint8_t second = readTetraPack();
-            read_buffer.push_back(combine4BitValues(first, second));
+            std::this_thread::sleep_for(std::chrono::microseconds(state.rx_period_us.load()));
         }
+        WideBus bus = state.bus.load();
+        if(bus == WideBus::Lending || bus == WideBus::Lent)
+        {
+            receiveBurst();
+            return;
+        }
+
+        std::array<uint8_t, BYTE_BETWEEN_SYNC> group{};
+        readGroup(group.data());        //a group that could not be read stays zero, the checksum sorts it out
 
-        if(read_buffer.size() == BYTE_BETWEEN_SYNC && read_buffer.front() != 0x01)
+        StackParser::Step step = parser.feed(group.data(), group.size());
+        followPeriod(step);
+        if(step == StackParser::Step::Broken && hunts < options.hunt_limit)      //the partner is still sending stacks, only our alignment with them is off
         {
-            std::vector<uint8_t> ref(BYTE_BETWEEN_SYNC, 22);
+            hunts++;
+            link.takeStackVerdict();
+            step = parser.hunt();
+        }
+
+        switch(step)
+        {
+        case StackParser::Step::More:
+        case StackParser::Step::Skipped:        //indirect check if there is still sync artifacts in buffer
+            return;
 
-            if(read_buffer == ref)
+        case StackParser::Step::Complete:
+            hunts = 0;
+            if(checkPattern())
             {
-                read_buffer.clear();
-                listening.store(false);
-                established.store(false);
-                currentState = 1;       //other client needs resync
                 return;
             }
+            break;
 
-            else
+        case StackParser::Step::Broken:         //pattern wasnt recognised for hunt_limit stacks in a row
+            link.takeStackVerdict();
+            break;
+
+        case StackParser::Step::Sync:           //other client needs resync
+            break;
+
+        case StackParser::Step::Request:        //lend our lines if our transmitter has nothing to put on them
+            if(options.wide_bus && link.capabilities().turnaround && state.tx_idle.load())
             {
-                read_buffer.clear();    //indirect check if there is still sync artifacts in buffer
-                return;
+                WideBus expected = WideBus::Split;
+                state.bus.compare_exchange_strong(expected, WideBus::Lending);
             }
+            return;
+
+        case StackParser::Step::Grant:          //only if our transmitter still waits for it
+        {
+            WideBus expected = WideBus::Requested;
+            state.bus.compare_exchange_strong(expected, WideBus::Borrowed);
+            return;
         }
 
-        if(read_buffer.size() == BYTE_PER_PACKAGE + HEADER_SIZE)
+        case StackParser::Step::Release:        //the end of a burst we did not read
+            return;
+        }
+        currentState = 1;
+        listening.store(false);
+        established.store(false);
+    }
+
+
+
+    void receiveBurst()         //the partner drives all 8 lines: its stacks arrive two groups to a frame until its release frame, broken ones never cost a resync
+    {
+        std::array<uint8_t, WideCoder::FRAME_BYTES> frame{};
+        bool lent = state.bus.load() == WideBus::Lent;          //the whole wait counts only if the partner could already send
+        if(!wide_coder.decodeFrame(wide_wire, frame.data(), BURST_TIMEOUT_POLLS))
         {
-            // std::cout << "ack queue size " << ack_queue.size() <<std::endl;
-            // for(uint8_t byte : read_buffer)        //output all bytes from the transmission
-            // {
-            //     std::cout << int(byte);
-            // }
+            if(lent)
+            {
+                endBurst();             //the partner gave up on the grant or its release frame got lost
+            }
+            return;                     //not granted yet, or granted while we waited
+        }
 
-            if(!checkPattern())            
+        for(size_t at = 0; at < frame.size(); at += BYTE_BETWEEN_SYNC)
+        {
+            StackParser::Step step = parser.feed(frame.data() + at, BYTE_BETWEEN_SYNC);
+            if(step == StackParser::Step::Broken && hunts < options.hunt_limit)
             {
-                // std::cout << "Pattern not recognised" << std::endl;
-                currentState = 1;   //if pattern wasnt recognised go back to sync state
-                listening.store(false);
-                established.store(false);
-                read_buffer.clear();
-                // std::cout << std::endl;
+                hunts++;
+                step = parser.hunt();
+            }
+            if(step == StackParser::Step::Complete)
+            {
+                hunts = 0;
+                checkPattern();
+            }
+            else if(step == StackParser::Step::Release)
+            {
+                endBurst();
                 return;
             }
-            // std::cout << "Pattern recognised, Data stored!" << std::endl;
-            read_buffer.clear();
         }
-        return;
     }
 
 
 
-    bool checkPattern() 
+    void endBurst()             //the lines go back to our transmitter once the partner surely let go of them
     {
-        std::vector<uint8_t> eot_reference(HEADER_SIZE + BYTE_PER_PACKAGE, 0x04);
-        eot_reference.front() = 0x01;       //start of header
-        eot_reference.back() = 0x03;        //end of text
-        if(read_buffer == eot_reference)        //receiver noticed other client's end of transmission
-        {
-            currentState = 2;               //write received message into output
-            return true;
-        }
+        std::this_thread::sleep_for(std::chrono::microseconds(uint64_t(WIDE_GUARD) * state.rx_period_us.load()));
+        parser.reset();
+        hunts = 0;
+        state.bus.store(WideBus::Split);
+    }
+
+
 
-        if (read_buffer[0] != 0x01) 
+    bool checkPattern()                 //the header is sane, the checksum decides what the stack is worth
+    {
+        std::optional<StackVerdict> verdict = link.takeStackVerdict();
+        if(parser.wasProtected())
         {
-            // std::cout << "pos 1" <<std::endl;
-            return false;
+            verdict.reset();            //the device checked the stack before the repair
         }
 
-        uint32_t received_package_sequence = (read_buffer[1] << 24) | (read_buffer[2] << 16) | (read_buffer[3] << 8) | read_buffer[4];
+        uint32_t received_package_sequence = parser.field(FIELD_SEQUENCE);
+        uint32_t checksum = parser.field(FIELD_CHECKSUM);
 
-        if (read_buffer[5] != 0x06 && read_buffer[5] != 0x15) 
+        if(!checkChecksum(checksum, verdict))
         {
-            // std::cout << "pos 2" <<std::endl;
-            return false;
+            if(parser.wasRepaired())
+            {
+                expectPeriod();             //FEC vouches for the header, the payload is still lost
+            }
+            if (received_package_sequence != uint32_t(~0))
+            {
+                neg_ack_queue.pushUnique(received_package_sequence);      //the pattern matched but checksum was wrong, ask for it right away (a corrupted number only costs a spurious resend)
+            }
+            state.rx_echo_us.store(0);                              //tells the partner its period may be too fast
+            return true;                                            //framing is intact, no need to resync
         }
 
-        uint32_t acknowledged_sequence = (read_buffer[6] << 24) | (read_buffer[7] << 16) | (read_buffer[8] << 8) | read_buffer[9];
+        //package is valid!
+        ack_reports.push({parser.field(FIELD_CUMULATIVE_ACK), parser.field(FIELD_SACK), std::chrono::steady_clock::now()});      //tell transmitter to not wait for any package the partner reported as received
 
-        if (read_buffer[10] != 0x16 || read_buffer[11] != 0x16) 
+        if(parser.at(POS_ACK_TYPE) == 0x15)
         {
-            // std::cout << "pos 3" <<std::endl;
-            return false;
+            resend_queue.pushUnique(parser.field(FIELD_NAK));             //partner received this package corrupted
         }
 
-        uint16_t checksum = (read_buffer[12] << 8) | (read_buffer[13]);
-
-        if (read_buffer[14] != 0x02) 
+        state.partner_window.store(parser.at(POS_WINDOW));
+        uint8_t caps = parser.at(POS_CAPS);
+        state.partner_caps.store(caps & ~(FLAG_FINISHED | FLAG_SAW_FINISHED | FLAG_ABORTED));
+        state.partner_heard.store(true);
+        state.partner_heard_at.store(std::chrono::steady_clock::now().time_since_epoch().count());
+        state.partner_saw_finished.store(caps & FLAG_SAW_FINISHED);
+        if((caps & FLAG_ABORTED) && !state.partner_aborted.load())
         {
-            // std::cout << "pos 4" <<std::endl;
-            return false;
+            if(!state.aborted.load())
+            {
+                std::cerr << "partner aborted the transfer" << std::endl;
+            }
+            state.partner_aborted.store(true);  //an answer to our own abort, or the partner's
+            state.aborted.store(true);          //our transmitter ends the session too
         }
+        if((caps & FLAG_FINISHED) && !partner_finished.load())
+        {
+            output.flush();                 //everything in order was already written by deliver()
+            partner_finished.store(true);   //the partner has every ACK for its input, nothing more comes
+        }
+        state.partner_sending.store(received_package_sequence != uint32_t(~0));
+        adoptPeriod();
 
-        if (read_buffer[read_buffer.size()-1] != 0x03) 
+        if (received_package_sequence == uint32_t(~0))
         {
-            // std::cout << "pos 5" <<std::endl;
-            return false;
+            return true;
         }
 
-        if(!checkChecksum(checksum))
+        if (received_package_sequence >= next_delivery + state.receive_window.load())
         {
-            neg_ack_queue.push(received_package_sequence);      //the pattern matched but checksum was wrong
-            // std::cout << "pos 6" <<std::endl;
-            return false;
+            return true;                                            //beyond the advertised window, partner sends it again later
         }
 
-        //package is valid!
-        if(read_buffer[5] == 0x06)
+        ack_queue.pushUnique(received_package_sequence);                  //tell transmitter to acknowledge this package
+
+        if (taken.insert(received_package_sequence))
         {
-            if (acknowledged_sequence == uint32_t(~0))
+            PayloadView payload = parser.payload();
+            if(bond)
             {
-                // std::cout << "Prevented removal of ~0" << std::endl;
+                bond->receiver.accept(payload.data, payload.size);     //the bond puts the chunks of all links in order
+                next_delivery = taken.runEnd(next_delivery);
+                return true;
             }
+            HeldPayload & held = reorder[received_package_sequence % REORDER_SLOTS];
+            held.sequence = received_package_sequence;
+            held.used = true;
+            held.compressed = parser.at(POS_FORMAT) & FORMAT_COMPRESSED;
+            held.length = static_cast<uint8_t>(payload.size);
+            std::copy(payload.data, payload.data + payload.size, held.bytes.begin());
+            deliver();
+        }
 
-            else
+        return true;
+    }
+
+
+
+    void deliver()              //writes every package that is now in order to the output
+    {
+        bool written = false;
+        if(state.aborted.load())
+        {
+            return;                     //nothing after a broken block makes sense anymore
+        }
+        for(HeldPayload * held = &reorder[next_delivery % REORDER_SLOTS]; held->used && held->sequence == next_delivery; held = &reorder[next_delivery % REORDER_SLOTS])
+        {
+            if(held->compressed)        //blocks may span packages, only complete ones come out
             {
-                // std::cout << "removed " << acknowledged_sequence << std::endl;
-                if(pending_ack.remove(acknowledged_sequence))              //tell transmitter to not wait for package he sent anymore with sequence number ACKNOWLEDGED SEQUENCE
+                decompressed.clear();
+                if(!decompressor.feed(held->bytes.data(), held->length, decompressed))
                 {
-                    // std::cout << "Successfully " << pending_ack.size() << std::endl;
+                    output.flush();
+                    std::cerr << "compressed stream from partner is corrupt, transfer aborted" << std::endl;
+                    state.aborted.store(true);          //the packages passed their checksum, a resend brings the same bytes; our transmitter tells the partner
+                    return;
                 }
+                output.write(reinterpret_cast<const char*>(decompressed.data()), decompressed.size());
             }
+            else
+            {
+                output.write(reinterpret_cast<const char*>(held->bytes.data()), held->length);
+            }
+            held->used = false;
+            next_delivery++;
+            written = true;
+        }
+        if(written)
+        {
+            output.flush();
         }
+    }
 
-        if (received_package_sequence == uint32_t(~0))
+
+
+    void adoptPeriod()          //echo the period this stack announces, the partner only switches to it once it read that echo back
+    {
+        uint32_t echo = parser.field(FIELD_PERIOD_ECHO) * PERIOD_UNIT_US;
+        state.partner_echo_us.store(echo);
+        state.partner_echoes.fetch_add(1);
+        expectPeriod();
+        uint32_t pending = state.rx_pending_us.load();
+        state.rx_echo_us.store(pending != 0 ? pending : state.rx_period_us.load());
+    }
+
+
+
+    void expectPeriod()         //an announced period other than the one we read at stays pending until the partner switched
+    {
+        uint32_t announced = parser.field(FIELD_PERIOD) * PERIOD_UNIT_US;
+        if(announced == 0)
         {
-            // std::cout << "Scrapped ~0 Package" << std::endl;
-            return true;
+            return;
+        }
+        if(announced == state.rx_period_us.load())
+        {
+            state.rx_pending_us.store(0);
+            return;
+        }
+        if(state.rx_pending_us.exchange(announced) != announced)
+        {
+            state.pending_echoed.store(LinkState::NOT_ECHOED);      //our transmitter has not said ready for this one yet
         }
+    }
+
 
-        else
-        {ack_queue.push(received_package_sequence);}        //tell transmitter to acknowledge this package
-                      
-        if (transmission_content.size() < (received_package_sequence+1) * BYTE_PER_PACKAGE)
+
+    void followPeriod(StackParser::Step step)       //a group that does not frame while a switch is pending was sent at the other period, a finished stack is a boundary to switch at
+    {
+        if(state.rx_pending_us.load() == 0)
         {
-            transmission_content.resize((received_package_sequence+1) * BYTE_PER_PACKAGE);
+            return;
+        }
+        if(step == StackParser::Step::Broken || step == StackParser::Step::Skipped)
+        {
+            if(period_hold > 0)
+            {
+                period_hold--;              //the rest of the stack the guess came in the middle of
+                return;
+            }
+            period_hold = (HEADER_SIZE + BYTE_PER_PACKAGE + FEC_PARITY) / BYTE_BETWEEN_SYNC;
+            state.rx_pending_us.store(state.rx_period_us.exchange(state.rx_pending_us.load()));        //keep the other one in case this guess was wrong as well
+            state.pending_echoed.store(LinkState::NOT_ECHOED);
+            return;
         }
+        if(step == StackParser::Step::Complete)
+        {
+            period_hold = 0;
+            followEcho();
+        }
+    }
 
-        auto insert_pos = transmission_content.begin() + received_package_sequence * BYTE_PER_PACKAGE;
-        std::copy(read_buffer.begin() + HEADER_SIZE - 1, read_buffer.end() - 1, insert_pos);
 
-        return true;
+
+    void followEcho()           //between stacks: switch once the partner can have read our ready echo, any stack it begins from then on comes at the new period
+    {
+        using namespace std::chrono;
+        uint32_t pending = state.rx_pending_us.load();
+        steady_clock::rep echoed = state.pending_echoed.load();
+        if(pending != 0 && echoed != LinkState::NOT_ECHOED && steady_clock::time_point(steady_clock::duration(echoed)) <= steady_clock::now())
+        {
+            state.rx_period_us.store(pending);
+            state.rx_pending_us.store(0);
+        }
     }
 
 
 
-    bool checkChecksum(uint16_t received_checksum)           //compares checksum received with calculated from package 
+    bool checkChecksum(uint32_t received_checksum, const std::optional<StackVerdict> & verdict)           //compares checksum received with the CRC over header and payload
     {
-        uint16_t checksum = 0;
-        for(uint32_t i = HEADER_SIZE-1; i<HEADER_SIZE+BYTE_PER_PACKAGE-1; i++) 
+        if(verdict && verdict->checksum == received_checksum)      //the device already computed it for this very stack
         {
-            checksum += read_buffer[i];
+            return verdict->valid;
         }
-        // std::cout << "checksum: " << int(checksum) << std::endl;
+        uint32_t checksum = stackChecksum(ChecksumType(parser.at(POS_FORMAT) & FORMAT_CHECKSUM), parser.data());
+        // std::cout << "checksum: " << checksum << std::endl;
         return checksum == received_checksum;
     }
 
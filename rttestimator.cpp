@@ -0,0 +1,56 @@
+#pragma once
+#include "netkitten.cpp"
+
+
+
+class RttEstimator      //Jacobson/Karels: smoothed round trip time and its variation give the retransmission timeout, doubled on every timeout
+{
+    private:
+    using Duration = std::chrono::steady_clock::duration;
+
+    Duration srtt{0};
+    Duration rttvar{0};
+    bool measured = false;              //srtt holds a sample, until then the timeout comes from the airtime estimate
+    uint32_t backoff = 0;               //timeouts since the last sample, each doubles the timeout
+
+    public:
+    void reset()            //the symbol period starts over, old samples say nothing about the new one
+    {
+        measured = false;
+        backoff = 0;
+    }
+
+
+
+    void sample(Duration rtt)       //only for packages sent once, Karn's rule: an ACK for a resent one could belong to either copy
+    {
+        if(!measured)
+        {
+            srtt = rtt;
+            rttvar = rtt / 2;
+            measured = true;
+        }
+        else
+        {
+            Duration error = rtt > srtt ? rtt - srtt : srtt - rtt;
+            rttvar = (3 * rttvar + error) / 4;
+            srtt = (7 * srtt + rtt) / 8;
+        }
+        backoff = 0;
+    }
+
+
+
+    void onTimeout()
+    {
+        backoff = std::min<uint32_t>(backoff + 1, 6);
+    }
+
+
+
+    Duration timeout(Duration floor, Duration initial, Duration ceiling) const      //floor and ceiling follow the current symbol period, initial stands in until the first sample
+    {
+        Duration base = measured ? srtt + 4 * rttvar : initial;
+        return std::clamp(base * (1 << backoff), floor, std::max(floor, ceiling));
+    }
+};
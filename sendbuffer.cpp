@@ -0,0 +1,78 @@
+#pragma once
+#include "netkitten.cpp"
+#include <condition_variable>
+
+
+
+class SendBuffer        //bounded byte FIFO between the input reader thread and the transmitter
+{
+    private:
+    std::deque<uint8_t> bytes;
+    size_t capacity;
+    bool closed = false;                //input reached its end, nothing more will be pushed
+    std::mutex lock;
+    std::condition_variable space;
+
+    public:
+    explicit SendBuffer(size_t cap)
+        : capacity(std::max<size_t>(cap, BYTE_PER_PACKAGE))
+    {
+
+    }
+
+
+
+    void push(const uint8_t* data, size_t count)        //blocks while the buffer is full
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        for(size_t i = 0; i < count; i++)
+        {
+            space.wait(guard, [&]{ return bytes.size() < capacity; });
+            bytes.push_back(data[i]);
+        }
+    }
+
+
+
+    size_t take(uint8_t* out, size_t max)               //never blocks, returns how many bytes were taken
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        size_t count = std::min(max, bytes.size());
+        std::copy(bytes.begin(), bytes.begin() + count, out);
+        bytes.erase(bytes.begin(), bytes.begin() + count);
+        space.notify_all();
+        return count;
+    }
+
+
+
+    size_t available()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        return bytes.size();
+    }
+
+
+
+    void close()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        closed = true;
+    }
+
+
+
+    bool isClosed()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        return closed;
+    }
+
+
+
+    bool finished()                     //input ended and everything was taken
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        return closed && bytes.empty();
+    }
+};
@@ -0,0 +1,47 @@
+#pragma once
+#include "netkitten.cpp"
+
+
+
+class SendWindow        //AIMD window counted in stacks: grows by one per window of clean ACKs, halves on loss
+{
+    private:
+    double window;
+    double min_window;
+    double max_window;
+    std::chrono::steady_clock::time_point last_decrease;
+
+    public:
+    explicit SendWindow(const LinkOptions & options)
+        : window(options.initial_window), min_window(std::max<uint32_t>(1, options.min_window)), max_window(std::max(options.min_window, options.max_window))
+    {
+        window = std::clamp(window, min_window, max_window);
+    }
+
+
+
+    void onAck()            //additive increase
+    {
+        window = std::min(max_window, window + 1.0 / window);
+    }
+
+
+
+    void onLoss(std::chrono::steady_clock::duration hold_off)       //multiplicative decrease, at most once per hold_off so one burst of loss only counts once
+    {
+        auto now = std::chrono::steady_clock::now();
+        if(now - last_decrease < hold_off)
+        {
+            return;
+        }
+        last_decrease = now;
+        window = std::max(min_window, window / 2);
+    }
+
+
+
+    uint32_t size() const
+    {
+        return static_cast<uint32_t>(window);
+    }
+};
@@ -0,0 +1,87 @@
+#pragma once
+#include <cstdint>
+#include <map>
+#include <iterator>
+
+
+
+class SequenceSet       //sequence numbers as disjoint runs [first, end), memory grows with the gaps and not with the transfer
+{
+    private:
+    std::map<uint32_t, uint32_t> runs;          //first -> one past the last, neighbouring runs are always merged
+
+    public:
+    bool insert(uint32_t sequence)              //false if it was already in
+    {
+        auto next = runs.upper_bound(sequence);
+        if(next != runs.begin())
+        {
+            auto previous = std::prev(next);
+            if(sequence < previous->second)
+            {
+                return false;
+            }
+            if(sequence == previous->second)    //extends the run before
+            {
+                previous->second++;
+                if(next != runs.end() && next->first == previous->second)
+                {
+                    previous->second = next->second;
+                    runs.erase(next);
+                }
+                return true;
+            }
+        }
+        if(next != runs.end() && next->first == sequence + 1)      //extends the run after to the front
+        {
+            uint32_t end = next->second;
+            runs.erase(next);
+            runs.emplace(sequence, end);
+            return true;
+        }
+        runs.emplace(sequence, sequence + 1);
+        return true;
+    }
+
+
+
+    bool contains(uint32_t sequence) const
+    {
+        auto next = runs.upper_bound(sequence);
+        return next != runs.begin() && sequence < std::prev(next)->second;
+    }
+
+
+
+    uint32_t runEnd(uint32_t from) const        //first sequence number at or after from that is missing
+    {
+        auto next = runs.upper_bound(from);
+        if(next == runs.begin())
+        {
+            return from;
+        }
+        auto previous = std::prev(next);
+        return from < previous->second ? previous->second : from;
+    }
+
+
+
+    template <typename Visit>
+    void forEachRunAfter(uint32_t from, Visit visit) const      //visit(first, end) for every run starting past from, in order, until visit returns false
+    {
+        for(auto it = runs.upper_bound(from); it != runs.end(); ++it)
+        {
+            if(!visit(it->first, it->second))
+            {
+                return;
+            }
+        }
+    }
+
+
+
+    size_t runCount() const
+    {
+        return runs.size();
+    }
+};
@@ -0,0 +1,230 @@
+#pragma once
+#include "netkitten.cpp"
+#include "frame.cpp"
+
+
+
+struct PayloadView          //bytes inside the parser, valid until the next stack is fed
+{
+    const uint8_t* data;
+    size_t size;
+};
+
+
+
+class StackParser           //takes a stack group by group into one fixed buffer and checks every header field as soon as its byte is in
+{
+    public:
+    enum class Step
+    {
+        More,           //the stack is not complete yet
+        Skipped,        //a group that cannot start a stack, leftovers of the SYNC phase
+        Sync,           //a whole group of SYNC, the partner wants to resync
+        Broken,         //a field that can not be right, no use reading the rest
+        Complete,       //a whole stack with a sane header, FEC already applied, the checksum is up to the caller
+        Request,        //a whole group of ENQ, the partner asks for our lines
+        Grant,          //a whole group of DC1, the partner lent us its lines
+        Release,        //a whole group of ETB, the partner's burst on the turned bus is over
+    };
+
+    private:
+    static constexpr size_t STACK_SIZE = HEADER_SIZE + BYTE_PER_PACKAGE;
+
+    std::array<uint8_t, STACK_SIZE + FEC_PARITY> bytes;
+    size_t filled = 0;
+    size_t expected = STACK_SIZE;
+    bool protect = false;           //parity follows, the header is only checked once it was repaired
+    bool done = false;              //the last step ended the stack, the next group starts a new one
+    bool repaired = false;          //the parity matched once FEC fixed what it could, the header can be trusted even if the CRC fails
+    ReedSolomon fec{FEC_PARITY};
+
+    public:
+    Step feed(const uint8_t* group, size_t count)
+    {
+        if(done)
+        {
+            reset();
+        }
+        if(filled == 0 && group[0] != 0x01)
+        {
+            done = true;
+            return controlGroup(group, count);
+        }
+
+        for(size_t i = 0; i < count && filled < expected; i++)
+        {
+            size_t position = filled;
+            bytes[filled++] = group[i];
+            if(position == POS_FORMAT)
+            {
+                protect = __builtin_popcount(group[i] >> 4) >= 2;          //one flipped line can not hide FEC
+                expected = STACK_SIZE + (protect ? FEC_PARITY : 0);
+            }
+            if(position == 0 || position >= STACK_SIZE || protect)
+            {
+                continue;
+            }
+
+            if(!fieldFits(position))
+            {
+                for(i++; i < count && filled < bytes.size(); i++)
+                {
+                    bytes[filled++] = group[i];         //keep the whole group, hunt() may find a stack starting in it
+                }
+                done = true;
+                return Step::Broken;
+            }
+        }
+
+        if(filled < expected)
+        {
+            return Step::More;
+        }
+        done = true;
+        if(protect)             //repair what we can, the CRC decides afterwards
+        {
+            repaired = fec.decode(bytes.data(), expected) >= 0;
+            for(size_t checked = 0; checked < STACK_SIZE; checked++)
+            {
+                if(!fieldFits(checked))
+                {
+                    return Step::Broken;
+                }
+            }
+        }
+        return Step::Complete;
+    }
+
+
+
+    Step hunt()             //after Broken: looks for the next stack among the groups already read, so a lost or extra group costs one stack and not a resync
+    {
+        std::array<uint8_t, STACK_SIZE + FEC_PARITY> held = bytes;
+        size_t held_size = filled;
+        for(size_t start = BYTE_BETWEEN_SYNC; start < held_size; start += BYTE_BETWEEN_SYNC)     //stacks begin on a group
+        {
+            if(held[start] != 0x01)
+            {
+                continue;
+            }
+            reset();
+            Step step = Step::More;
+            for(size_t at = start; at < held_size && step == Step::More; at += BYTE_BETWEEN_SYNC)
+            {
+                step = feed(held.data() + at, std::min<size_t>(BYTE_BETWEEN_SYNC, held_size - at));
+            }
+            if(step != Step::Broken)
+            {
+                return step;
+            }
+        }
+        reset();
+        return Step::Skipped;           //nothing in there, the next group may start one
+    }
+
+
+
+    void reset()
+    {
+        filled = 0;
+        expected = STACK_SIZE;
+        protect = false;
+        done = false;
+        repaired = false;
+    }
+
+
+
+    bool between() const            //no group of the next stack read yet
+    {
+        return done || filled == 0;
+    }
+
+
+
+    bool wasProtected() const
+    {
+        return protect;
+    }
+
+
+
+    bool wasRepaired() const
+    {
+        return repaired;
+    }
+
+
+
+    const uint8_t* data() const         //the whole stack without parity
+    {
+        return bytes.data();
+    }
+
+
+
+    uint8_t at(uint32_t position) const
+    {
+        return bytes[position];
+    }
+
+
+
+    uint32_t field(HeaderField header_field) const
+    {
+        return getField(bytes.data(), header_field);
+    }
+
+
+
+    PayloadView payload() const
+    {
+        return {bytes.data() + POS_TEXT + 1, bytes[POS_LENGTH]};
+    }
+
+
+
+    private:
+    static Step controlGroup(const uint8_t* group, size_t count)         //a group between stacks, only whole groups of one control character mean something
+    {
+        static constexpr std::pair<uint8_t, Step> CONTROLS[] = {{0x16, Step::Sync}, {0x05, Step::Request}, {0x11, Step::Grant}, {0x17, Step::Release}};
+        for(const auto & [control, step] : CONTROLS)
+        {
+            if(std::all_of(group, group + count, [control = control](uint8_t byte) { return byte == control; }))
+            {
+                return step;
+            }
+        }
+        return Step::Skipped;
+    }
+
+
+
+    bool fieldFits(size_t position) const       //the rules a single byte has to follow, whatever the rest says
+    {
+        uint8_t byte = bytes[position];
+        switch(position)
+        {
+        case 0:
+            return byte == 0x01;
+        case POS_FORMAT:
+        {
+            uint8_t checksum_type = byte & FORMAT_CHECKSUM;
+            uint8_t protection = byte & 0xF0;
+            return (checksum_type == uint8_t(ChecksumType::Crc16) || checksum_type == uint8_t(ChecksumType::Crc32c)) && (protection == 0 || protection == FORMAT_FEC);
+        }
+        case POS_ACK_TYPE:
+            return byte == 0x06 || byte == 0x15;
+        case POS_LENGTH:
+            return byte <= BYTE_PER_PACKAGE;
+        case POS_WINDOW:
+            return byte != 0;
+        case POS_TEXT:
+            return byte == 0x02;
+        case STACK_SIZE - 1:
+            return byte == 0x03;
+        default:
+            return true;
+        }
+    }
+};
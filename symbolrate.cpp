@@ -0,0 +1,63 @@
+#pragma once
+#include "netkitten.cpp"
+
+
+
+class SymbolRate        //period we put nibbles on the wire with: shortened while the partner keeps confirming it, doubled on loss
+{
+    private:
+    uint32_t base_us;                   //period every session starts and resyncs with
+    uint32_t floor_us;                  //never send faster than this
+    uint32_t current_us;
+    uint32_t confirmed = 0;             //stacks the partner decoded at current_us since the last change
+    uint32_t speedup_after;
+    std::chrono::steady_clock::time_point last_increase;
+
+    public:
+    explicit SymbolRate(const LinkOptions & options)
+        : base_us(options.base_period_us), floor_us(std::min(options.min_period_us, options.base_period_us)), current_us(options.base_period_us), speedup_after(std::max<uint32_t>(1, options.speedup_after))
+    {
+
+    }
+
+
+
+    void reset()            //back to the period both peers handshake with
+    {
+        current_us = base_us;
+        confirmed = 0;
+    }
+
+
+
+    void onConfirmed()      //the partner echoed the period it decoded our last stack at
+    {
+        if(++confirmed < speedup_after || current_us <= floor_us)
+        {
+            return;
+        }
+        current_us = std::max(floor_us, current_us * 3 / 4);
+        confirmed = 0;
+    }
+
+
+
+    void onLoss(std::chrono::steady_clock::duration hold_off)       //back off fast, at most once per hold_off so one burst of loss only counts once
+    {
+        confirmed = 0;
+        auto now = std::chrono::steady_clock::now();
+        if(now - last_increase < hold_off)
+        {
+            return;
+        }
+        last_increase = now;
+        current_us = std::min(base_us, current_us * 2);
+    }
+
+
+
+    uint32_t period() const
+    {
+        return current_us;
+    }
+};
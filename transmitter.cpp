@@ -1,10 +1,24 @@
 #include "netkitten.cpp"
+#include "linkdriver.cpp"
+#include "linkengine.cpp"
+#include "sendwindow.cpp"
+#include "acktracker.cpp"
+#include "sendbuffer.cpp"
+#include "symbolrate.cpp"
+#include "inflight.cpp"
+#include "rttestimator.cpp"
+#include "linecoder.cpp"
+#include "frame.cpp"
+#include "bond.cpp"
 
 
 
 class Transmitter
 {
     private:
+    static constexpr uint32_t WIDE_MIN_STACKS = 4;          //packages that have to be ready before asking the partner for its lines pays off
+    static constexpr uint32_t WIDE_BACKOFF_STACKS = 16;     //packages sent split after the partner did not grant, before asking again
+
     std::vector<uint8_t> control_chars = {
     0x00, // NUL (Null)
     0x01, // SOH (Start of Heading)
@@ -40,57 +54,187 @@ class Transmitter
     0x1F  // US  (Unit Separator)
     };
 
-    B15F* b15f;
-    boost::asio::serial_port* serial;
-    TimedQueue & pending_ack;           //stores the sequence_num's which havn't been acknowledged yet
-    TimedQueue & ack_queue;             //stores the acknowledgments which still need to be sent
-    TimedQueue & neg_ack_queue;         //stores negative acknowledgments which need to be sent
+    LinkDriver & link;
+    std::istream & input;
+    Channel<AckReport> & ack_reports;   //what the partner acknowledged, receiver to transmitter
+    UniqueChannel<uint32_t> & ack_queue;      //stores the acknowledgments which still need to be sent
+    UniqueChannel<uint32_t> & neg_ack_queue;  //stores negative acknowledgments which need to be sent
+    UniqueChannel<uint32_t> & resend_queue;   //stores the sequence_num's the partner reported corrupted
     std::atomic<bool> & established;              //is sent data received
     std::atomic<bool> & listening;                //is own receiver currently reading data
     std::atomic<bool> & partner_finished;         //does other client finished transmission
-    std::mutex & hardware_lock;
-    int mode = 0;
-    std::vector<uint8_t> transmission_content;
-    std::queue<uint32_t> sequence_num_queue;      //stores all sequence numbers in order to be sent
-    std::vector<uint32_t> already_sent_acks;      //stores which packages were already acknowledged from himself
-    unsigned short resync_count = 0;              //counts sent nibbles to controll when to resync periodically
+    LinkScheduler & scheduler;          //owns the device, every write goes through it
+    LinkState & state;
+    const LinkOptions & options;
+    SendWindow window;                            //how many stacks may be unacknowledged at once
+    InFlight in_flight;                           //sent sequence_num's, when they were last put on the wire and when to resend them
+    RttEstimator rtt;                             //how long the partner takes to acknowledge a stack
+    SendBuffer send_buffer;                       //input read ahead, not yet cut into packages
+    std::atomic<bool> compressing{false};         //send_buffer holds compressed blocks, decided before the first byte is pushed
+    FramePool frames;                             //every package built in place until the partner acknowledged it
+    uint32_t next_sequence = 0;                   //sequence number the next package gets
+    std::queue<uint32_t> sequence_num_queue;      //stores the sequence numbers in order to be sent
+    ReedSolomon fec{FEC_PARITY};
+    AckTracker acks;                              //what was received from the partner and has to be acknowledged
+    SymbolRate rate;                              //period the next stacks are announced with
+    uint32_t tx_period_us;                        //period nibbles are written with right now
+    uint32_t seen_echoes = 0;                     //partner echoes already fed into rate
+    std::chrono::steady_clock::time_point agreed_at;          //last time the period we announce was the one we send at
+    std::unique_ptr<LineCoder> coder;             //how byte groups become nibbles on the wire
+    std::vector<uint8_t> group;                   //bytes waiting for their group to be complete
+    std::vector<uint8_t> nibbles;                 //the coded group being written
+    std::chrono::steady_clock::time_point burst_end;          //when the device has written everything we queued on it
+    uint32_t burst_period_us = 0;                 //period of what is queued on the device
+    std::chrono::steady_clock::time_point next_write;         //slot of the next single nibble
+    WideCoder wide_coder;                         //our stacks while we drive all 8 lines
+    bool wide = false;                            //we borrowed the partner's lines, writeByte() fills frames of two groups
+    uint32_t wide_backoff = 0;                    //packages to send split before the next request
+    Bond * bond;                                  //packages come from the bond instead of input, nullptr on a single link
+    uint32_t bond_link;                           //our index among the bonded links
     bool list_mode = false;                       //true if started in listening mode
 
 
     public:
-    Transmitter(B15F* board, boost::asio::serial_port* ser, TimedQueue & pen_ack, TimedQueue & ack_q, TimedQueue & neg_ack_q, std::atomic<bool> & es, std::atomic<bool> & li, std::atomic<bool> & pf, std::mutex & hl, int mo)
-        : b15f(board), serial(ser), pending_ack(pen_ack), ack_queue(ack_q), neg_ack_queue(neg_ack_q), established(es), listening(li), partner_finished(pf), hardware_lock(hl), mode(mo)
+    Transmitter(LinkDriver & drv, std::istream & in, Channel<AckReport> & reports, UniqueChannel<uint32_t> & ack_q, UniqueChannel<uint32_t> & neg_ack_q, UniqueChannel<uint32_t> & res_q, std::atomic<bool> & es, std::atomic<bool> & li, std::atomic<bool> & pf, LinkScheduler & sch, LinkState & ls, const LinkOptions & opt, Bond * bd = nullptr, uint32_t index = 0)
+        : link(drv), input(in), ack_reports(reports), ack_queue(ack_q), neg_ack_queue(neg_ack_q), resend_queue(res_q), established(es), listening(li), partner_finished(pf), scheduler(sch), state(ls), options(opt), window(opt), send_buffer(opt.send_buffer_size), rate(opt), tx_period_us(opt.base_period_us), coder(makeLineCoder(opt.line_coding)), bond(bd), bond_link(index)
     {
 
     }
 
 
 
-    void beginTransmission()        //prepare by reading cin
+    void beginTransmission()        //read the input stream while already transmitting
     {
-        char byte;
-        while (std::cin.get(byte)) 
+        if(bond)
         {
-            transmission_content.push_back(static_cast<uint8_t>(byte));
+            transmissionController();       //the bond reads the input for all links
+            return;
         }
-        processData();
+        std::thread reader(&Transmitter::readInput, this);
+        transmissionController();
+        reader.join();
         return;
     }
 
+
+
+    void readInput()                //reader thread: hands the input to the send buffer as soon as it arrives
+    {
+        std::vector<uint8_t> chunk;
+        std::vector<uint8_t> block;
+        std::unique_ptr<StreamCompressor> compressor;
+        bool decided = false;
+        size_t chunk_limit = options.compression == Compression::Off ? BYTE_PER_PACKAGE : COMPRESS_BLOCK;
+        char byte;
+
+        auto handOver = [&]()
+        {
+            if(chunk.empty())
+            {
+                return;
+            }
+            if(!decided)            //the first chunk shows whether the input is worth compressing
+            {
+                decided = true;
+                if(shouldCompress(chunk))
+                {
+                    compressor = std::make_unique<StreamCompressor>(options.compression);
+                    compressing.store(true);
+                }
+            }
+            if(compressor)
+            {
+                block.clear();
+                compressor->compress(chunk.data(), chunk.size(), block);
+                send_buffer.push(block.data(), block.size());
+            }
+            else
+            {
+                send_buffer.push(chunk.data(), chunk.size());
+            }
+            chunk.clear();
+        };
+
+        while (input.get(byte)) 
+        {
+            chunk.push_back(static_cast<uint8_t>(byte));
+            if(chunk.size() >= chunk_limit || input.rdbuf()->in_avail() <= 0)       //nothing more buffered, dont wait for a full chunk
+            {
+                handOver();
+            }
+        }
+        handOver();
+        send_buffer.close();
+    }
+
+
+
+    uint32_t packagesOpened() const         //sequence numbers handed out so far, resends not counted
+    {
+        return next_sequence;
+    }
+
+
+
+    bool shouldCompress(const std::vector<uint8_t> & first_chunk)       //waits until the partner told us whether it can decompress, at most an ACK timeout at the base period
+    {
+        if(options.compression == Compression::Off || looksCompressed(first_chunk.data(), first_chunk.size()))
+        {
+            return false;
+        }
+        auto deadline = std::chrono::steady_clock::now() + options.ack_timeout_stacks * stackAirtime(options.base_period_us);
+        while(!state.partner_heard.load())
+        {
+            if(std::chrono::steady_clock::now() >= deadline)
+            {
+                return false;           //a partner that only listens may never send a stack we could hear it from, uncompressed it reads anyway
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(SEND_DELAY));
+        }
+        return state.partner_caps.load() & CAP_COMPRESS;
+    }
+
     
     
-    void processData()             //pads content and generates sequence numbers
+    bool processData()             //cuts the next package out of the send buffer and generates its sequence number
     {
-        uint8_t padding = BYTE_PER_PACKAGE - (transmission_content.size() % BYTE_PER_PACKAGE);
-        transmission_content.insert(transmission_content.end(), padding, 0x00);       //adds padding if needed
-        transmission_content.back() = padding;
+        if(bond)
+        {
+            return processChunk();
+        }
+        size_t available = send_buffer.available();
+        if(available == 0)
+        {
+            return false;
+        }
+        if(available < BYTE_PER_PACKAGE && !send_buffer.isClosed() && !in_flight.empty())
+        {
+            return false;               //wait for a full package while earlier ones are still in flight
+        }
+
+        Frame & frame = frames.open(next_sequence);
+        size_t length = send_buffer.take(frame.payload(), BYTE_PER_PACKAGE);    //straight into the frame, the rest stays zero padding
+        putField(frame.bytes.data(), FIELD_LENGTH, static_cast<uint32_t>(length));
+        sequence_num_queue.push(next_sequence);
+        next_sequence++;
+        return true;
+    }
 
-        for(uint32_t i = 0; i < transmission_content.size() / BYTE_PER_PACKAGE; i++)        //generate all the sequence numbers
+
+
+    bool processChunk()             //the next chunk of a bonded transfer becomes our next package, under our own sequence number
+    {
+        Frame & frame = frames.open(next_sequence);
+        size_t length = bond->sender.take(bond_link, frame.payload(), !in_flight.empty());
+        if(length == 0)
         {
-            sequence_num_queue.push(i);
+            frames.release(next_sequence);
+            return false;
         }
-        transmissionController();
-        return;
+        putField(frame.bytes.data(), FIELD_LENGTH, static_cast<uint32_t>(length));
+        sequence_num_queue.push(next_sequence);
+        next_sequence++;
+        return true;
     }
     
     
@@ -98,55 +242,62 @@ class Transmitter
     void transmissionController()       //controlls everything from resyncing and sending the packages
     {
         bool final_ack = false;         //handles the last mandatory ACK to complete handshake
-        bool transmission_complete = false;     //handles the last EOT signal if nothing anymore to send
         int status = 0;                 //decides the state of the transmitter
         bool terminated = false;
+        uint32_t toResend = 0;
 
         while(!terminated)         //transmission main loop
         {
-            uint32_t toResend;
+            if(state.bus.load() == WideBus::Lending)
+            {
+                lendBus();                  //between two stacks, our receiver promised the partner our lines
+            }
+            if(wide && status != 1 && status != 2)
+            {
+                returnBus();                //nothing left we could send in a burst
+            }
+
             switch(status)
             {
             case 0:         //SYNC State
                 // std::cout << "Trying to sync communication." << std::endl;
                 final_ack = true;
-                transmission_complete = false;      //eliminates chance for partner to desync on sending EOT
-                if(!already_sent_acks.empty())      //expect the last ACK sent to partner wasnt received
-                {
-                    ack_queue.push(already_sent_acks.back());
-                    already_sent_acks.pop_back();
-                }
+                acks.markUnsent();                  //expect the last ACK sent to partner wasnt received
+                rate.reset();                       //the handshake always runs at the base period
+                rtt.reset();
+                tx_period_us = options.base_period_us;
+                agreed_at = std::chrono::steady_clock::now();
                 syncComs();
                 break;
             
             case 1:         //USUAL transmission State
                 sendStack(sequence_num_queue.front());
                 sequence_num_queue.pop();
+                if(!wide && wide_backoff > 0)
+                {
+                    wide_backoff--;
+                }
                 break;
 
-            case 2:         //RESEND lost or delayed packages State
-                // std::cout << "Sending package " << pending_ack.front() << " again!" << std::endl;
-                toResend = pending_ack.front();
-                pending_ack.pop();
-                pending_ack.push(toResend);
+            case 2:         //RESEND a corrupted package or the one whose ACK is overdue State
+                // std::cout << "Sending package " << toResend << " again!" << std::endl;
+                window.onLoss(retransmitTimeout());
+                rate.onLoss(retransmitTimeout());
                 sendStack(toResend);
                 break;
 
             case 3:         //RESPOND only to received signal State
-                if(!transmission_complete)
+                sendStack(uint32_t(~0));    //FLAG_FINISHED in every one until the partner said it got it
+                break;
+
+            case 4:         //WAIT for ACKs or input State
+                collectReceived();
+                if(acks.hasUnsent() || !neg_ack_queue.empty())
                 {
-                    // std::cout << "Sending EOT Signal" << std::endl;
-                    transmission_complete = true;
-                    writeByte(0x01);
-                    for(uint32_t i = 0; i < HEADER_SIZE+BYTE_PER_PACKAGE-2; i++)
-                    {
-                        writeByte(0x04);        //send a stack filled with EOT to signal end of transmission
-                    }
-                    writeByte(0x03);
+                    sendStack(uint32_t(~0));    //keep acknowledging the partner in the meantime
                     break;
                 }
-
-                sendStack(uint32_t(~0));    //only respond from now on
+                std::this_thread::sleep_for(std::chrono::microseconds(tx_period_us));
                 break;
             
             default:
@@ -165,19 +316,53 @@ class Transmitter
             }
 
             if(!established.load() || !listening.load())      //if desynced try resync
-            {status = 0; continue;}
+            {
+                if(bond && status != 0)
+                {
+                    offerAll();                 //the other links carry our packages while we resync
+                }
+                if(sourceFinished() && partner_finished.load() && (bond || partnerSilent()))
+                {
+                    return;                     //the other links finished the transfer, or the partner stopped after we both did
+                }
+                if(state.aborted.load() && partnerSilent())
+                {
+                    return;                     //the session was given up on and the partner went quiet
+                }
+                status = 0;
+                continue;
+            }
 
-            if(pending_ack.empty() && sequence_num_queue.empty())               //there is no more to send, just respond other client
+            collectAcks();
+            adaptRate();
+            state.tx_idle.store(in_flight.empty() && sequence_num_queue.empty() && pendingInput() == 0);
+
+            if(state.aborted.load())        //one side could not use what it received, the session ends without the rest
             {
-                if(partner_finished.load())
+                if(wide)
                 {
-                    // std::cout << "Program ended successfully!" << std::endl;
-                    writeByte(0x01);
-                    for(uint32_t i = 0; i < HEADER_SIZE+BYTE_PER_PACKAGE-2; i++)
+                    returnBus();
+                }
+                bool answered = state.partner_aborted.load() || partnerSilent();
+                sendStack(uint32_t(~0));        //FLAG_ABORTED in every one until the partner answered with its own
+                if(answered)
+                {
+                    terminated = true;
+                    return;
+                }
+                continue;
+            }
+
+            if(sourceFinished())     //there is no more to send, just respond other client
+            {
+                if(partner_finished.load() && (state.partner_saw_finished.load() || partnerSilent()))
+                {
+                    if(wide)
                     {
-                        writeByte(0x04);        //send last stack filled with EOT to signal end of transmission
+                        returnBus();
                     }
-                    writeByte(0x03);
+                    // std::cout << "Program ended successfully!" << std::endl;
+                    sendStack(uint32_t(~0));    //tells the partner we got its end as well; should this one get lost, it stops once we stayed silent for an ACK timeout
                     terminated = true;
                     return;
                 }               //nothing to send and nothing to receive anymore
@@ -185,14 +370,20 @@ class Transmitter
                 continue;
             }
 
-            if(pending_ack.size() < 10 && !sequence_num_queue.empty())          //send next package as usual
-            {status = 1; continue;}
+            if(findCorrupted(toResend) || (!wide && findOverdue(toResend)))   //resend what the partner NAKed or whose retransmission timer ran out, no ACK can come during a burst
+            {status = 2; continue;}
 
-            if((pending_ack.size() >= 10) || sequence_num_queue.empty())        //pending ACKs exceed 10 limit, resend lost packages
+            if(!wide && wideBurst() >= WIDE_MIN_STACKS)       //the partner only acknowledges: wait until a whole burst fits instead of trickling packages out split
             {
-                status = 2; 
-                continue;
+                if(openable() < wideBurst())
+                {status = 4; continue;}
+                borrowBus();
             }
+
+            if(mayOpenPackage() && (!sequence_num_queue.empty() || processData()))   //send next package as usual
+            {status = 1; continue;}
+
+            status = 4;                                                         //window is full or input is not ready yet
         }
         return;
     }
@@ -232,159 +423,455 @@ class Transmitter
 
     void sendStack(uint32_t package_index)                                                                  //send the correstponding package for package_index
     {
-        std::vector<uint8_t> stack_package = {0x01};                                                        //begin with start of heading
-        std::vector<uint8_t> index_conversion = uint32ToByte(uint32_t(package_index));
-        stack_package.insert(stack_package.end(), index_conversion.begin(), index_conversion.end());        //insert sequence number
+        bool protect = protecting();
+        bool compressed = package_index != uint32_t(~0) && compressing.load();
+        Frame * found = package_index == uint32_t(~0) ? &frames.control() : frames.find(package_index);
+        if(found == nullptr)
+        {
+            return;                     //acknowledged while it waited in a queue
+        }
+        uint8_t* stack = found->bytes.data();                                                               //SOH, sequence number, length, STX, payload and ETX are already in place
+        putField(stack, FIELD_FORMAT, uint8_t(options.checksum) | (protect ? FORMAT_FEC : 0) | (compressed ? FORMAT_COMPRESSED : 0));
+
+        collectReceived();
+        std::optional<uint32_t> toNak = nextNak();
+        putField(stack, FIELD_ACK_TYPE, toNak ? 0x15 : 0x06);                                               //send acknowledgment, flag if a NAK is carried as well
+        putField(stack, FIELD_CUMULATIVE_ACK, acks.cumulative());
+        putField(stack, FIELD_SACK, acks.bitmap());
+        acks.markSent();
+        putField(stack, FIELD_NAK, toNak.value_or(~0));
+
+        putField(stack, FIELD_WINDOW, state.receive_window.load());                                         //how many stacks our receiver buffers
+        uint8_t flags = (package_index == uint32_t(~0) && sourceFinished() ? FLAG_FINISHED : 0) | (partner_finished.load() ? FLAG_SAW_FINISHED : 0) | (state.aborted.load() ? FLAG_ABORTED : 0);
+        putField(stack, FIELD_CAPS, CAP_FEC | CAP_COMPRESS | (canTurn() ? CAP_WIDE : 0) | flags);            //what our receiver understands, how far the end of the session got
+        uint32_t echo = std::min<uint32_t>(state.rx_echo_us.load() / PERIOD_UNIT_US, 0xFFFF);
+        putField(stack, FIELD_PERIOD, announcedPeriod() / PERIOD_UNIT_US);                                  //the period we want to send at, we switch once the partner echoed it
+        putField(stack, FIELD_PERIOD_ECHO, echo);                                                           //what our receiver expects the partner's next stacks at, 0 if the last one was corrupted
+        putField(stack, FIELD_CHECKSUM, stackChecksum(options.checksum, stack));                            //the CRC over header and payload
+
+        size_t stack_size = HEADER_SIZE + BYTE_PER_PACKAGE;
+        if(protect)
+        {
+            fec.encode(stack, stack_size, stack + stack_size);                                              //parity over the whole stack behind it
+            stack_size += FEC_PARITY;
+        }
 
-        stack_package.push_back(0x06);                                                                  //send acknowledgment
-        uint32_t toAck = ack_queue.front();
-        std::vector<uint8_t> ack_conversion = uint32ToByte(~0);
-        while(!ack_queue.empty())
+        for(size_t i = 0; i < stack_size; i++)                                                              //actually sending the message
+        {
+            writeByte(stack[i]);
+        }
+        if(echo != 0 && echo * PERIOD_UNIT_US == state.rx_pending_us.load())                               //our receiver follows once the partner can have read this
         {
-            if(std::find(already_sent_acks.begin(), already_sent_acks.end(), toAck) == already_sent_acks.end())
+            auto sent = std::max({std::chrono::steady_clock::now(), burst_end, next_write}).time_since_epoch().count();
+            std::chrono::steady_clock::rep unset = LinkState::NOT_ECHOED;
+            state.pending_echoed.compare_exchange_strong(unset, sent);
+        }
+
+        if(package_index != uint32_t(~0))
+        {
+            in_flight.sent(package_index, std::chrono::steady_clock::now(), retransmitTimeout());          //the timer counts from the end of the stack
+        }
+
+        // std::cout << std::endl;
+        // std::cout << "Package " << package_index << " was sent." << std::endl;
+        // std::cout << "sequence num content front size " << sequence_num_queue.front()<<sequence_num_queue.size() << std::endl;
+    }
+
+
+
+    void collectAcks()      //drops every package in flight the partner reported as received, the latest one sent only once gives an RTT sample
+    {
+        while(std::optional<AckReport> report = ack_reports.pop())
+        {
+            std::optional<std::chrono::steady_clock::duration> sample;
+            in_flight.acknowledge(*report, [&](uint32_t sequence, bool sent_once, std::chrono::steady_clock::time_point sent)
             {
-                ack_conversion = uint32ToByte(toAck);
-                ack_queue.remove(toAck);
-                already_sent_acks.push_back(toAck);
-                break;
-            }
-            else
+                window.onAck();
+                Frame * frame = frames.find(sequence);
+                if(bond && frame)
+                {
+                    bond->sender.acknowledge(frame->payload());
+                }
+                frames.release(sequence);               //the partner has it, the slot is free for a later package
+                if(sent_once && report->arrived > sent && (!sample || report->arrived - sent < *sample))       //a report older than a restarted timer says nothing about the round trip
+                {
+                    sample = report->arrived - sent;
+                }
+            });
+            if(sample)
             {
-                ack_queue.pop();
+                rtt.sample(*sample);
             }
         }
-        stack_package.insert(stack_package.end(), ack_conversion.begin(), ack_conversion.end());        //insert acknowledgment number
-        
-        stack_package.insert(stack_package.end(), 2, 0x16);                                                 //insert a sync idle check
-        uint16_t checksum = calcChecksum(package_index);
-        std::vector<uint8_t> check_conversion = {static_cast<uint8_t>((checksum >> 8) & 0xFF),
-                                                 static_cast<uint8_t>(checksum & 0xFF)};
-        stack_package.insert(stack_package.end(), check_conversion.end()-2, check_conversion.end());        //insert the corresponding 16 bit checksum
-        stack_package.push_back(0x02);                                                                      //insert start of text
+    }
+
+
 
-        if(package_index == uint32_t(~0))       //send empty package
+    void adaptRate()        //a new echo from the partner confirms our period, says it is ready for the one we announced, or reports our last stack corrupted
+    {
+        auto now = std::chrono::steady_clock::now();
+        if(announcedPeriod() == tx_period_us)
         {
-            stack_package.insert(stack_package.end(), BYTE_PER_PACKAGE, 0x00);                              //add BYTE_PER_PACKAGE byte of null values
+            agreed_at = now;
         }
-
-        else        //send normal message content
+        else if(announcedPeriod() > tx_period_us && now - agreed_at > 4 * ackTimeout())
         {
-            for(uint32_t i = package_index*BYTE_PER_PACKAGE; i<package_index*BYTE_PER_PACKAGE+BYTE_PER_PACKAGE; i++)                                        
-            { 
-                stack_package.push_back(transmission_content[i]);                                           //add BYTE_PER_PACKAGE byte of data
-            }
+            established.store(false);       //the partner can not even read that we want to slow down, start over at the base period
+            listening.store(false);
+            return;
+        }
 
-            pending_ack.push(package_index);                                                                //add sent package sequence number to pending acknowledgements
+        uint32_t echoes = state.partner_echoes.load();
+        if(echoes == seen_echoes)
+        {
+            return;
+        }
+        seen_echoes = echoes;
+        uint32_t echo = state.partner_echo_us.load();
+        if(echo == 0)
+        {
+            rate.onLoss(retransmitTimeout());
+        }
+        else if(echo == tx_period_us && announcedPeriod() == tx_period_us)
+        {
+            rate.onConfirmed();
+        }
+        else if(echo == announcedPeriod())
+        {
+            tx_period_us = echo;            //from the next stack on, the partner follows at its next stack boundary
         }
+    }
+
+
 
-        stack_package.push_back(0x03);                                                                      //end on end of text
+    uint32_t announcedPeriod() const        //what rate wants, in the resolution of the period field
+    {
+        return std::min<uint32_t>(rate.period() / PERIOD_UNIT_US, 0xFFFF) * PERIOD_UNIT_US;
+    }
 
-        for(uint8_t byte : stack_package)                                                                   //actually sending the message
+
+
+    void collectReceived()      //moves what the receiver queued for acknowledgment into the ACK state
+    {
+        while(std::optional<uint32_t> sequence = ack_queue.pop())
         {
-            writeByte(byte);
+            acks.received(*sequence);
         }
+    }
 
-        // std::cout << std::endl;
-        // std::cout << "Package " << package_index << " was sent." << std::endl;
-        // std::cout << "sequence num content front size " << sequence_num_queue.front()<<sequence_num_queue.size() << " pending ack content front size " << pending_ack.front()<<pending_ack.size() << std::endl;
-        // std::cout << "Checksum " << int(checksum) << std::endl;
+
+
+    bool canTurn() const
+    {
+        return options.wide_bus && link.capabilities().turnaround;
     }
 
 
 
-    void writeByte(uint8_t byte)
+    size_t wideBurst()          //packages a burst on the partner's lines would carry once the windows are empty enough, 0 if we may not ask for them
     {
-        // std::cout << "Sending " << int(byte) << std::endl;
+        if(!canTurn() || !(state.partner_caps.load() & CAP_WIDE) || state.partner_sending.load() || state.bus.load() != WideBus::Split || wide_backoff > 0)
+        {
+            return 0;
+        }
+        size_t ready = sequence_num_queue.size() + (pendingInput() + BYTE_PER_PACKAGE - 1) / BYTE_PER_PACKAGE;
+        return std::min<size_t>({ready, window.size(), state.partner_window.load()});
+    }
+
 
-        if (resync_count % BYTE_BETWEEN_SYNC == 0 && resync_count != 0)
+
+    void borrowBus()            //asks for the partner's lines with a group of ENQ, a group of DC1 back means they are ours after the guard time
+    {
+        using namespace std::chrono;
+        state.bus.store(WideBus::Requested);
+        for(uint32_t i = 0; i < BYTE_BETWEEN_SYNC; i++)
         {
-            writeTetraPack(0b00001111);
-            writeTetraPack(0b00000000);
+            writeByte(0x05);
+        }
+
+        auto deadline = steady_clock::now() + 2 * stackAirtime();      //the partner finishes its current stack first
+        while(state.bus.load() == WideBus::Requested && steady_clock::now() < deadline)
+        {
+            std::this_thread::sleep_for(microseconds(tx_period_us));
+        }
+        WideBus expected = WideBus::Requested;
+        if(state.bus.compare_exchange_strong(expected, WideBus::Split))
+        {
+            wide_backoff = WIDE_BACKOFF_STACKS;         //the partner is busy or missed it, stay split for a while
+            return;
         }
 
-        writeTetraPack(getBits(byte, 4));
-        writeTetraPack(getBits(byte, 0));
+        std::this_thread::sleep_for(microseconds(uint64_t(WIDE_GUARD) * std::max(tx_period_us, state.rx_period_us.load())));
+        scheduler.turnBus(BusDirection::Send);
+        wide = true;
+    }
+
+
 
-        if (resync_count % BYTE_BETWEEN_SYNC == BYTE_BETWEEN_SYNC - 1)
+    void returnBus()            //a release frame of ETB, then the partner gets its lines back
+    {
+        for(uint32_t i = 0; i < WideCoder::FRAME_BYTES; i++)
         {
-            writeTetraPack(0b00000000);
-            writeTetraPack(0b00001111);
+            writeByte(0x17);
         }
+        std::this_thread::sleep_until(next_write);      //the lead-out keeps its whole period
+        scheduler.turnBus(BusDirection::Split);
+        in_flight.restartTimers(std::chrono::steady_clock::now(), retransmitTimeout());      //no ACK could come back during the burst
+        wide = false;
+        state.bus.store(WideBus::Split);
+    }
 
-        resync_count++;
+
+
+    void lendBus()              //grants with a group of DC1, listens on all lines until our receiver saw the partner's burst end
+    {
+        for(uint32_t i = 0; i < BYTE_BETWEEN_SYNC; i++)
+        {
+            writeByte(0x11);
+        }
+        std::this_thread::sleep_until(next_write);
+        scheduler.turnBus(BusDirection::Listen);
+        WideBus expected = WideBus::Lending;
+        state.bus.compare_exchange_strong(expected, WideBus::Lent);
+        while(state.bus.load() == WideBus::Lent)
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(tx_period_us));
+        }
+        scheduler.turnBus(BusDirection::Split);
     }
 
 
 
-    void writeTetraPack(uint8_t half_byte)
+    bool mayOpenPackage()       //both our send window and the partner's receive window have room for the next sequence number
     {
-        //TODO implement to write 4 bit onto register
-        using namespace std::chrono;
-        auto now = steady_clock::now();
+        return openable() > 0;
+    }
 
-        auto nextTick = now + milliseconds(SEND_DELAY);
 
-        while(true) 
+
+    size_t openable() const     //sequence numbers both windows still have room for
+    {
+        uint32_t oldest = in_flight.oldest().value_or(next_sequence);
+        uint32_t upcoming = sequence_num_queue.empty() ? next_sequence : sequence_num_queue.front();
+        size_t ours = in_flight.size() < window.size() ? window.size() - in_flight.size() : 0;
+        size_t partners = upcoming < oldest + state.partner_window.load() ? oldest + state.partner_window.load() - upcoming : 0;
+        return std::min(ours, partners);
+    }
+
+
+
+    std::optional<uint32_t> nextNak()          //oldest corrupted sequence_num which still wasnt received correctly
+    {
+        while(std::optional<uint32_t> sequence = neg_ack_queue.pop())
         {
-            if(hardware_lock.try_lock())
+            if(!acks.has(*sequence))
             {
-                switch (mode)
-                {
-                case 1:
-                    b15f->setMem8(&PORTA, half_byte);                     //write values on 4 lines
-                    break;
-                
-                case 2:
-                    //send command
-                    const char command = 'W';
-                    boost::asio::write(*serial, boost::asio::buffer(&command, 1));
-                    //send value
-                    boost::asio::write(*serial, boost::asio::buffer(&half_byte, 1));
-                    break;
-                }
-                
-                hardware_lock.unlock();
-                break;
+                return sequence;
             }
         }
-        
-        std::this_thread::sleep_until(nextTick);
+        return std::nullopt;
+    }
+
+
+
+    bool findCorrupted(uint32_t & package_index)        //a NAKed package skips the ACK timeout and is resent right away
+    {
+        while(std::optional<uint32_t> sequence = resend_queue.pop())
+        {
+            if(in_flight.contains(*sequence))
+            {
+                package_index = *sequence;
+                return true;
+            }
+        }
+        return false;
+    }
+
+
+
+    bool findOverdue(uint32_t & package_index)      //the package whose retransmission timer ran out first, backs the timer off
+    {
+        std::optional<uint32_t> expired = in_flight.expired(std::chrono::steady_clock::now());
+        if(!expired)
+        {
+            return false;
+        }
+        package_index = *expired;
+        rtt.onTimeout();
+        if(bond)
+        {
+            offer(package_index);       //this link may be degrading, let another one try as well
+        }
+        return true;
+    }
+
+
+
+    size_t pendingInput()           //input bytes not cut into packages yet
+    {
+        return bond ? bond->sender.available() : send_buffer.available();
+    }
+
+
+
+    bool partnerSilent() const      //no stack from the partner passed its checksum for an ACK timeout, after the end it may have stopped already
+    {
+        auto heard = std::chrono::steady_clock::time_point(std::chrono::steady_clock::duration(state.partner_heard_at.load()));
+        return std::chrono::steady_clock::now() - heard > ackTimeout();
     }
 
 
 
-    uint8_t getBits(uint8_t c, int shift)
+    bool sourceFinished()           //nothing left we still have to get to the partner
     {
-        uint8_t sequence;
-        sequence = (c >> shift) & 0x0F;
+        if(bond)
+        {
+            return bond->sender.finished();         //packages still in flight here already arrived over another link
+        }
+        return in_flight.empty() && sequence_num_queue.empty() && send_buffer.finished();
+    }
+
+
 
-        return sequence;
+    void offer(uint32_t sequence)
+    {
+        if(Frame * frame = frames.find(sequence))
+        {
+            bond->sender.offer(bond_link, frame->payload(), getField(frame->bytes.data(), FIELD_LENGTH));
+        }
     }
 
 
 
-    uint16_t calcChecksum(uint32_t current_package)
+    void offerAll()                 //every package we opened and the partner did not acknowledge yet
     {
-        uint16_t checksum = 0;
-        for(uint32_t i = current_package*BYTE_PER_PACKAGE; i<current_package*BYTE_PER_PACKAGE+BYTE_PER_PACKAGE; i++) 
+        frames.forEachOpen([&](Frame & frame)
         {
-            checksum += transmission_content[i];
+            offer(frame.sequence);
+        });
+    }
+
+
+
+    bool protecting() const         //negotiated: we want FEC and the partner can decode it
+    {
+        return options.fec && (state.partner_caps.load() & CAP_FEC);
+    }
+
+
+
+    std::chrono::microseconds stackAirtime() const      //one stack at the slower of both directions
+    {
+        return stackAirtime(std::max(tx_period_us, state.rx_period_us.load()));
+    }
+
+
+
+    std::chrono::microseconds stackAirtime(uint64_t period) const      //one stack as our line coding puts it on the wire, parity included
+    {
+        uint32_t stack_bytes = HEADER_SIZE + BYTE_PER_PACKAGE + (protecting() ? FEC_PARITY : 0);
+        double symbols = coder->symbolsPerGroup() * stack_bytes / BYTE_BETWEEN_SYNC;
+        return std::chrono::microseconds(std::llround(symbols * period));
+    }
+
+
+
+    std::chrono::microseconds ackTimeout() const        //a stack to the partner, one back and some slack for queued ACKs
+    {
+        return options.ack_timeout_stacks * stackAirtime();
+    }
+
+
+
+    std::chrono::steady_clock::duration retransmitTimeout() const      //measured once ACKs came back, never shorter than the partner needs to answer at all
+    {
+        return rtt.timeout(2 * stackAirtime(), ackTimeout(), 4 * ackTimeout());
+    }
+
+
+
+    void writeByte(uint8_t byte)        //everything sent is a multiple of BYTE_BETWEEN_SYNC, a group goes out once it is complete
+    {
+        // std::cout << "Sending " << int(byte) << std::endl;
+        group.push_back(byte);
+        if(wide)
+        {
+            if(group.size() == WideCoder::FRAME_BYTES)
+            {
+                writeWideFrame();
+            }
+            return;
+        }
+        if(group.size() < BYTE_BETWEEN_SYNC)
+        {
+            return;
         }
 
-        return checksum;
+        nibbles.clear();
+        coder->encodeGroup(group.data(), nibbles);        //a coded device frames the group itself, the nibble count still tells how long it takes
+        LinkCapabilities caps = link.capabilities();
+        if(caps.batch || caps.coded)
+        {
+            writeBurst(caps.coded);
+        }
+        else
+        {
+            for(uint8_t half_byte : nibbles)
+            {
+                writeTetraPack(half_byte);
+            }
+        }
+        group.clear();
     }
 
 
 
-    std::vector<uint8_t> uint32ToByte(uint32_t value)
+    void writeBurst(bool coded)       //the device times the group itself, we keep one group queued ahead so samples the scheduler puts in between cant starve it
     {
-        return 
+        using namespace std::chrono;
+        if(burst_period_us != tx_period_us)
         {
-            static_cast<uint8_t>((value >> 24) & 0xFF), // Most significant byte
-            static_cast<uint8_t>((value >> 16) & 0xFF),
-            static_cast<uint8_t>((value >> 8) & 0xFF),
-            static_cast<uint8_t>(value & 0xFF)          // Least significant byte
-        };
+            std::this_thread::sleep_until(burst_end);       //the device changes its period for everything queued, let the old one finish
+            burst_period_us = tx_period_us;
+        }
+
+        microseconds period(tx_period_us);
+        if(coded)
+        {
+            scheduler.writeGroups(group.data(), 1, period);
+        }
+        else
+        {
+            scheduler.writeNibbles(nibbles.data(), nibbles.size(), period);
+        }
+        burst_end = std::max(burst_end, steady_clock::now()) + period * nibbles.size();
+        std::this_thread::sleep_until(burst_end - period * nibbles.size());
+    }
+
+
+
+    void writeWideFrame()
+    {
+        using namespace std::chrono;
+        nibbles.clear();
+        wide_coder.encodeFrame(group.data(), nibbles);
+        for(uint8_t symbol : nibbles)
+        {
+            auto slot = std::max(next_write, steady_clock::now());
+            next_write = slot + microseconds(tx_period_us);
+            scheduler.writeWide(symbol, slot);         //write values on all 8 lines
+        }
+        group.clear();
+    }
+
+
+
+    void writeTetraPack(uint8_t half_byte)
+    {
+        using namespace std::chrono;
+        auto slot = std::max(next_write, steady_clock::now());      //right after the last one, or right away after a pause
+        next_write = slot + microseconds(tx_period_us);
+        scheduler.write(half_byte, slot);                   //write values on 4 lines
     }
 
 };
\ No newline at end of file